@@ -3,6 +3,7 @@
 #include <SDL3/SDL.h>
 #include <SDL3_image/SDL_image.h>
 #include <box2d/box2d.h>
+#include "bagel.h"
 using namespace std;
 
 Pong::Pong()
@@ -69,6 +70,30 @@ Pong::~Pong()
 	SDL_Quit();
 }
 
+void Pong::step()
+{
+	constexpr float STEP = 1.f/FPS;
+	// the clock is only read when the stages get recorded
+	const bool profiled = bagel::Profiler::enabled();
+	const std::int64_t start = profiled ? bagel::Profiler::now() : 0;
+	{
+		const bagel::Profiler::Scope profile("b2World_Step");
+		b2World_Step(world, STEP, 4);
+	}
+	if (!profiled)
+		return;
+	// box2d times its stages itself, in ms; they run one after the other
+	const b2Profile p = b2World_GetProfile(world);
+	const std::pair<const char*, float> stages[] = {
+		{"b2 pairs", p.pairs}, {"b2 collide", p.collide}, {"b2 solve", p.solve}};
+	std::int64_t at = start;
+	for (const auto& [name, ms] : stages) {
+		const auto ns = static_cast<std::int64_t>(ms * 1e6f);
+		bagel::Profiler::record(name, at, ns);
+		at += ns;
+	}
+}
+
 void Pong::run()
 {
 	SDL_SetRenderDrawColor(ren, 0,0,0,255);
@@ -76,11 +101,10 @@ void Pong::run()
 		BALL_TEX.w*TEX_SCALE,
 		BALL_TEX.h*TEX_SCALE};
 
-	constexpr float STEP = 1.f/FPS;
 	constexpr float RAD_TO_DEG = 57.2958f;
 
 	for (int i = 0; i < 1000; ++i) {
-		b2World_Step(world, STEP, 4);
+		step();
 
 		b2Vec2 p = b2Body_GetPosition(ballBody);
 		r.x = p.x*BOX_SCALE;
@@ -89,11 +113,17 @@ void Pong::run()
 		b2Rot rot = b2Body_GetRotation(ballBody);
 		float a = RAD_TO_DEG * b2Rot_GetAngle(rot);
 
-		SDL_RenderClear(ren);
-		SDL_RenderTextureRotated(
-			ren, tex, &BALL_TEX, &r, a,
-			nullptr, SDL_FLIP_NONE);
-		SDL_RenderPresent(ren);
+		{
+			const bagel::Profiler::Scope profile("render");
+			SDL_RenderClear(ren);
+			SDL_RenderTextureRotated(
+				ren, tex, &BALL_TEX, &r, a,
+				nullptr, SDL_FLIP_NONE);
+		}
+		{
+			const bagel::Profiler::Scope profile("present");
+			SDL_RenderPresent(ren);
+		}
 
 		SDL_Delay(5);
 	}
@@ -10,6 +10,8 @@ public:
 
 	void run();
 private:
+	void step();
+
 	static constexpr int FPS = 60;
 	static constexpr float BOX_SCALE = 10;
 	static constexpr float TEX_SCALE = 0.5f;
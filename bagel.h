@@ -1,13 +1,49 @@
 // Copyright (C) 2025 Moshe Sulamy
 
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace bagel
 {
+	/// Backing memory of DynamicBag, see BagMemory.
+	enum class Allocation { Malloc, Aligned, HugePages, Reserve };
+
 	struct Bagel
 	{
 		bool	DynamicResize = false;
@@ -15,14 +51,25 @@ namespace bagel
 		int		InitialEntities = 10;
 		int		InitialPackedSize = 5;
 		int		MaxComponents = 10;
+		int		ChunkSize = 16*1024;
+		int		Threads = 0;
+		Allocation	Allocator = Allocation::Malloc;
+		std::size_t	ReserveBytes = std::size_t{1} << 28;
+		bool	TrivialComponents = false;	///< reject components that are not trivially copyable
+		int		PageSize = 4096;	///< entries per PagedBag page, a power of two
 	};
 
 	template <class T> struct Storage;
 	template <class T> class PackedStorage;
 	template <class T> class SparseStorage;
 	template <class T> class TaggedStorage;
+	template <class T> class ArchetypeStorage;
+	template <class T> class SoAStorage;
+	template <class T> class HierarchyStorage;
+	template <class T> struct StorageOrder;
 
-#if __has_include("bagel_cfg.h")
+	// BAGEL_DEFAULT_PARAMS skips bagel_cfg.h, see tests_static.cpp
+#if __has_include("bagel_cfg.h") && !defined(BAGEL_DEFAULT_PARAMS)
 	#define BAGEL_STORAGE(C,T) template <> struct Storage<C> { using type = T<C>; };
 	#include "bagel_cfg.h"
 	#undef BAGEL_STORAGE
@@ -32,13 +79,28 @@ namespace bagel
 
 	using id_type = int;
 	struct ent_type { id_type id; };
+	inline id_type highestId(const ent_type* es, int n) {
+		id_type m = -1;
+		for (int i = 0; i < n; ++i)
+			m = std::max(m, es[i].id);
+		return m;
+	}
 	using size_type = int;
 	using index_type = int;
+	/// a registry's change clock, see World::advanceTick()
+	using tick_type = std::uint32_t;
+
+	/// Orders entities by id, the default order of PackedStorage::sort().
+	struct IdOrder {
+		bool operator()(ent_type a, ent_type b) const { return a.id < b.id; }
+	};
+	// exact widths: the fast types are 8 bytes wide on x86-64 and would
+	// quadruple every entity's mask
 	using mask_type =
-		std::conditional_t<Params.MaxComponents<=8, std::uint_fast8_t,
-		std::conditional_t<Params.MaxComponents<=16, std::uint_fast16_t,
-		std::conditional_t<Params.MaxComponents<=32, std::uint_fast32_t,
-			std::uint_fast64_t>>>;
+		std::conditional_t<Params.MaxComponents<=8, std::uint8_t,
+		std::conditional_t<Params.MaxComponents<=16, std::uint16_t,
+		std::conditional_t<Params.MaxComponents<=32, std::uint32_t,
+			std::uint64_t>>>;
 	constexpr inline size_type BitsetWidth = sizeof(mask_type)*8;
 
 	class NoInstance { NoInstance() = delete; };
@@ -48,37 +110,250 @@ namespace bagel
 		void operator=(const NoCopy&) = delete;
 	};
 
+	inline void* alignedAlloc(std::size_t bytes, std::size_t align) {
+		bytes = (bytes + align-1) / align * align;
+#ifdef _WIN32
+		return _aligned_malloc(bytes, align);
+#else
+		return aligned_alloc(align, bytes);
+#endif
+	}
+	inline void alignedFree(void* p) {
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	/// Resumable insertion sort of slots [first, last), of which [first, sorted)
+	/// are already in order: sinks each next slot with swap(i-1, i) while
+	/// less(i, i-1). Stops between slots once budget runs out and returns
+	/// whether the whole range is in order.
+	template <class Less, class Swap>
+	bool insertionSort(index_type first, index_type last, size_type& sorted,
+			Less&& less, Swap&& swap, std::chrono::microseconds budget) {
+		using Clock = std::chrono::steady_clock;
+		const Clock::time_point deadline = budget == std::chrono::microseconds::max() ?
+			Clock::time_point::max() : Clock::now() + budget;
+		sorted = std::clamp(sorted, first, last);
+		for (index_type n = 1; sorted < last; ++n) {
+			for (index_type i = sorted++; i > first && less(i, i-1); --i)
+				swap(i-1, i);
+			// the clock costs more than a slot that is already in place
+			if (n % 64 == 0 && Clock::now() >= deadline)
+				return sorted == last;
+		}
+		return true;
+	}
+
+	/// Memory behind DynamicBag, picked by Params.Allocator:
+	/// Malloc grows with realloc. Aligned hands out 64-byte aligned blocks.
+	/// HugePages maps whole 2MB pages (MAP_HUGETLB, else madvise) and only
+	/// moves when growth crosses a page. Reserve reserves ReserveBytes of
+	/// address space up front and commits pages as the bag grows, so the
+	/// data never moves until the reservation is exceeded.
+	class BagMemory final : NoInstance
+	{
+	public:
+		static constexpr std::size_t Alignment = 64;
+		static constexpr std::size_t HugePageSize = std::size_t{2} << 20;
+
+		template <Allocation A = Params.Allocator>
+		static void* allocate(std::size_t bytes) {
+			return grow<A>(nullptr, 0, bytes);
+		}
+
+		/// Returns a block of bytes holding the first used bytes of p.
+		/// p is released unless the same pointer is returned.
+		template <Allocation A = Params.Allocator>
+		static void* grow(void* p, std::size_t used, std::size_t bytes) {
+			if constexpr (A == Allocation::Malloc)
+				return realloc(p, bytes);
+			else if constexpr (A == Allocation::Aligned)
+				return relocate(p, used, alignedAlloc(bytes, Alignment), [&] { alignedFree(p); });
+			else if constexpr (A == Allocation::HugePages) {
+				if (extend<A>(p, used, bytes))
+					return p;
+				return relocate(p, used, mapHuge(hugeBytes(bytes)), [&] { unmap(p, hugeBytes(used)); });
+			}
+			else {
+				if (extend<A>(p, used, bytes))
+					return p;
+				void* fresh = reserve(reserveBytes(bytes));
+				commit(fresh, bytes);
+				return relocate(p, used, fresh, [&] { unmap(p, reserveBytes(used)); });
+			}
+		}
+
+		/// Grows p to bytes where it lies, which HugePages can within its last
+		/// page and Reserve within its reservation. Returns false otherwise.
+		template <Allocation A = Params.Allocator>
+		static bool extend(void* p, std::size_t used, std::size_t bytes) {
+			if constexpr (A == Allocation::HugePages)
+				return p && hugeBytes(bytes) == hugeBytes(used);
+			else if constexpr (A == Allocation::Reserve) {
+				if (!p || reserveBytes(bytes) != reserveBytes(used))
+					return false;
+				commit(p, bytes);
+				return true;
+			}
+			else
+				return false;
+		}
+
+		/// bytes is the size of the latest grow() of p.
+		template <Allocation A = Params.Allocator>
+		static void release(void* p, std::size_t bytes) {
+			if constexpr (A == Allocation::Malloc)
+				free(p);
+			else if constexpr (A == Allocation::Aligned)
+				alignedFree(p);
+			else if constexpr (A == Allocation::HugePages)
+				unmap(p, hugeBytes(bytes));
+			else
+				unmap(p, reserveBytes(bytes));
+		}
+	private:
+		template <class F>
+		static void* relocate(void* from, std::size_t used, void* to, F release) {
+			if (from) {
+				memcpy(to, from, used);
+				release();
+			}
+			return to;
+		}
+
+		static std::size_t roundUp(std::size_t n, std::size_t to) { return (n + to-1) / to * to; }
+		static std::size_t hugeBytes(std::size_t n) { return roundUp(std::max<std::size_t>(n, 1), HugePageSize); }
+		/// a power of two, so every size inside a reservation maps back to it
+		static std::size_t reserveBytes(std::size_t n) {
+			std::size_t r = hugeBytes(Params.ReserveBytes);
+			while (r < n)
+				r *= 2;
+			return r;
+		}
+
+#ifdef _WIN32
+		static void* mapHuge(std::size_t bytes) {
+			const std::size_t large = GetLargePageMinimum();
+			if (large && bytes % large == 0)
+				if (void* p = VirtualAlloc(nullptr, bytes, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE))
+					return p;
+			return VirtualAlloc(nullptr, bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+		}
+		static void* reserve(std::size_t bytes) {
+			return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+		}
+		static void commit(void* p, std::size_t bytes) {
+			VirtualAlloc(p, bytes, MEM_COMMIT, PAGE_READWRITE);
+		}
+		static void unmap(void* p, std::size_t) {
+			if (p)
+				VirtualFree(p, 0, MEM_RELEASE);
+		}
+#else
+		static void* mapHuge(std::size_t bytes) {
+			void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+			p = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+			if (p == MAP_FAILED) {
+				p = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+				if (p != MAP_FAILED)
+					madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+			}
+			return p == MAP_FAILED ? nullptr : p;
+		}
+		static void* reserve(std::size_t bytes) {
+			void* p = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+			return p == MAP_FAILED ? nullptr : p;
+		}
+		static void commit(void* p, std::size_t bytes) {
+			static const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+			mprotect(p, roundUp(bytes, page), PROT_READ|PROT_WRITE);
+		}
+		static void unmap(void* p, std::size_t bytes) {
+			if (p)
+				munmap(p, bytes);
+		}
+#endif
+	};
+
+	/// Growable array holding live objects in [0, size()). Trivially
+	/// copyable T relocate bytewise through BagMemory::grow; any other T is
+	/// move-constructed into a fresh block unless the block extends in place.
 	template <class T, int N>
 	class DynamicBag : NoCopy
 	{
 	public:
-		void push(const T& t) {
-			if (_size == _capacity) {
-				_capacity *= 2;
-				_arr = static_cast<T*>(
-					realloc(_arr, sizeof(T)*_capacity));
-			}
-			_arr[_size] = t;
-			++_size;
+		void push(const T& t) { emplace(t); }
+		void push(T&& t) { emplace(std::move(t)); }
+		template <class ...Args>
+		T& emplace(Args&&... args) {
+			if (_size == _capacity)
+				grow(_capacity*2);
+			return *new (_arr + _size++) T(std::forward<Args>(args)...);
+		}
+		void push(const T* ts, size_type n) {
+			ensure(_size+n);
+			std::uninitialized_copy(ts, ts+n, _arr+_size);
+			_size += n;
 		}
 		void ensure(size_type s) {
-			if (_capacity < s) {
-				_capacity = std::max(s, _capacity*2);
-				_arr = static_cast<T*>(
-					realloc(_arr, sizeof(T)*_capacity));
-			}
+			if (_capacity < s)
+				grow(std::max(s, _capacity*2));
+		}
+		T pop() {
+			T t = std::move(_arr[--_size]);
+			_arr[_size].~T();
+			return t;
 		}
-		T pop() { return _arr[--_size]; }
 		T& operator[](index_type i) { return _arr[i]; }
 		const T& operator[](index_type i) const { return _arr[i]; }
-		void clear() { _size = 0; }
+		T* data() { return _arr; }
+		const T* data() const { return _arr; }
+		void clear() { truncate(0); }
+		/// default-initializes new elements, which leaves trivial T untouched
+		void resize(size_type s) {
+			if (s <= _size)
+				return truncate(s);
+			ensure(s);
+			std::uninitialized_default_construct(_arr+_size, _arr+s);
+			_size = s;
+		}
+		/// destroys the elements from s on; unlike resize() it never
+		/// constructs, so T needs no default constructor
+		void truncate(size_type s) {
+			std::destroy(_arr+s, _arr+_size);
+			_size = s;
+		}
 
 		size_type size() const { return _size; }
 		size_type capacity() const { return _capacity; }
 
-		~DynamicBag() { free(_arr); }
+		~DynamicBag() {
+			std::destroy(_arr, _arr+_size);
+			BagMemory::release(_arr, sizeof(T)*_capacity);
+		}
 	private:
-		T*			_arr = static_cast<T*>(malloc(sizeof(T) * N));
+		void grow(size_type capacity) {
+			const std::size_t used = sizeof(T)*_capacity, bytes = sizeof(T)*capacity;
+			if constexpr (std::is_trivially_copyable_v<T>)
+				_arr = static_cast<T*>(BagMemory::grow(_arr, used, bytes));
+			else if (!BagMemory::extend(_arr, used, bytes)) {
+				T* fresh = static_cast<T*>(BagMemory::allocate(bytes));
+				std::uninitialized_move(_arr, _arr+_size, fresh);
+				std::destroy(_arr, _arr+_size);
+				BagMemory::release(_arr, used);
+				_arr = fresh;
+			}
+			_capacity = capacity;
+		}
+
+		T*			_arr = static_cast<T*>(BagMemory::allocate(sizeof(T) * N));
 		size_type	_size = 0;
 		size_type	_capacity = N;
 	};
@@ -87,10 +362,27 @@ namespace bagel
 	{
 	public:
 		void push(const T& t) { _arr[_size++] = t; }
-		T pop() { return _arr[--_size]; }
+		void push(T&& t) { _arr[_size++] = std::move(t); }
+		template <class ...Args>
+		T& emplace(Args&&... args) { return _arr[_size++] = T(std::forward<Args>(args)...); }
+		void push(const T* ts, size_type n) {
+			std::copy(ts, ts+n, _arr+_size);
+			_size += n;
+		}
+		T pop() { return std::move(_arr[--_size]); }
 		T& operator[](index_type i) { return _arr[i]; }
 		const T& operator[](index_type i) const { return _arr[i]; }
+		T* data() { return _arr; }
+		const T* data() const { return _arr; }
 		void clear() { _size = 0; }
+		void resize(size_type s) { _size = s; }
+		/// drops the elements from s on; the array outlives them, so those
+		/// holding resources are reset to T{} rather than destroyed
+		void truncate(size_type s) {
+			if constexpr (!std::is_trivially_destructible_v<T>)
+				std::fill(_arr+s, _arr+_size, T{});
+			_size = s;
+		}
 
 		size_type size() const { return _size; }
 		static void ensure(size_type) {}
@@ -101,59 +393,887 @@ namespace bagel
 	template <class T, int N>
 	using Bag = std::conditional_t<Params.DynamicResize, DynamicBag<T, N>, StaticBag<T,N>>;
 
+	/// Array indexed by entity id, split into pages of Params.PageSize
+	/// entries that are allocated when an id in them is first claimed.
+	/// Pages not claimed yet share one null page of default values, so a
+	/// lookup is two loads and the memory follows the occupied id ranges
+	/// rather than the highest id. Pages never move once allocated.
 	template <class T>
-	class SparseStorage final : NoInstance
+	class PagedBag : NoCopy
 	{
+		static_assert((Params.PageSize & (Params.PageSize-1)) == 0, "PageSize must be a power of two");
+		static constexpr unsigned Shift = [] {
+			unsigned s = 0;
+			while ((1 << s) < Params.PageSize)
+				++s;
+			return s;
+		}();
+		static constexpr unsigned Low = Params.PageSize-1;
 	public:
-		static void add(ent_type e, const T& t) {
-			_bag.ensure(e.id);
-			_bag[e.id] = t;
+		/// ids that were never claimed may read the null page
+		T& operator[](index_type i) { return at(_pages.data(), i); }
+		const T& operator[](index_type i) const { return at(_pages.data(), i); }
+
+		/// the entry of id i, on a page of its own
+		T& claim(index_type i) {
+			const index_type p = unsigned(i) >> Shift;
+			while (_pages.size() <= p)
+				_pages.push(nullPage());
+			if (_pages[p] == nullPage())
+				_pages[p] = newPage();
+			return _pages[p][unsigned(i) & Low];
+		}
+
+		/// the page table, for loops that look ids up through at()
+		T* const* pages() const { return _pages.data(); }
+		/// calls f(p, page) for every page p that holds entries
+		template <class F>
+		void eachPage(F&& f) const {
+			for (index_type p = 0; p < _pages.size(); ++p)
+				if (_pages[p] != nullPage())
+					f(p, static_cast<const T*>(_pages[p]));
+		}
+		/// page p, allocated if needed
+		T* claimPage(index_type p) { return &claim(p << Shift); }
+		static T& at(T* const* pages, index_type i) { return pages[unsigned(i) >> Shift][unsigned(i) & Low]; }
+
+		size_type allocated() const {
+			size_type n = 0;
+			for (index_type p = 0; p < _pages.size(); ++p)
+				n += _pages[p] != nullPage();
+			return n;
+		}
+
+		~PagedBag() {
+			for (index_type p = 0; p < _pages.size(); ++p)
+				if (_pages[p] != nullPage()) {
+					std::destroy_n(_pages[p], Params.PageSize);
+					alignedFree(_pages[p]);
+				}
+		}
+	private:
+		/// zeroed for trivially copyable T, default-constructed otherwise
+		static T* newPage() {
+			T* page = static_cast<T*>(alignedAlloc(sizeof(T)*Params.PageSize, 64));
+			if constexpr (std::is_trivially_copyable_v<T>)
+				memset(static_cast<void*>(page), 0, sizeof(T)*Params.PageSize);
+			else
+				std::uninitialized_default_construct_n(page, Params.PageSize);
+			return page;
+		}
+		static T* nullPage() {
+			static T* const page = newPage();
+			return page;
+		}
+
+		Bag<T*,(Params.InitialEntities+Params.PageSize-1)/Params.PageSize> _pages;
+	};
+
+	/// Optional compile-time component list. Defining
+	///		#define BAGEL_COMPONENTS A, B, C
+	/// in bagel_cfg.h, and expanding BAGEL_COMPONENT_LIST next to the
+	/// Storage specializations once A, B and C are declared, gives them the
+	/// constant indices 0, 1 and 2, so their Bits and the masks built from
+	/// them are constexpr. Unlisted components are numbered after the list
+	/// during static initialization.
+	template <class ...Ts>
+	struct Components
+	{
+		static_assert(sizeof...(Ts) <= Params.MaxComponents, "Params.MaxComponents is smaller than the component list");
+		static constexpr size_type Size = sizeof...(Ts);
+
+		/// position of T in the list, -1 when it is not listed
+		template <class T>
+		static constexpr index_type indexOf() {
+			index_type i = 0, found = -1;
+			((found = std::is_same_v<T, Ts> ? i : found, ++i), ...);
+			return found;
+		}
+	};
+#ifdef BAGEL_COMPONENTS
+	/// only declared, so a translation unit that uses components without
+	/// the program's list fails to compile instead of numbering them apart
+	template <class = void>
+	struct ComponentList;
+	#define BAGEL_COMPONENT_LIST template <> struct ComponentList<> : Components<BAGEL_COMPONENTS> {};
+#else
+	template <class = void>
+	struct ComponentList : Components<> {};
+#endif
+	/// void_t defers the lookup to the use of T, after the specialization
+	template <class T>
+	inline constexpr bool IsListed = ComponentList<std::void_t<T>>::template indexOf<T>() >= 0;
+
+	template <class T, bool = IsListed<T>> struct Component;
+
+	/// Owns one simulation: entity ids and masks, presence columns,
+	/// archetypes and every component storage. World, Entity and the
+	/// storages work on the calling thread's current registry, which is
+	/// the default one unless a Scope selects another. Registries share no
+	/// state, so each can be stepped on its own thread.
+	class alignas(64) Registry : NoCopy
+	{
+	public:
+		/// slots past the component indices, for the engine's own state
+		enum : index_type { WorldSlot = Params.MaxComponents, PresenceSlot, ArchetypesSlot, ObserversSlot, Slots };
+
+		constexpr Registry() = default;
+		~Registry() {
+			for (index_type i = 0; i < Slots; ++i)
+				if (void* st = _states[i].load(std::memory_order_relaxed))
+					_drops[i](st);
+		}
+
+		static Registry& current() { return *_current; }
+
+		/// the tick stamped on components modified now
+		tick_type tick() const { return _tick; }
+		tick_type advanceTick() { return ++_tick; }
+
+		/// Makes a registry current on this thread for the scope's lifetime.
+		class Scope : NoCopy
+		{
+		public:
+			explicit Scope(Registry& r) : _prev(_current) { _current = &r; }
+			~Scope() { _current = _prev; }
+		private:
+			Registry* _prev;
+		};
+
+		/// the D in `slot`, created on first use on its own cache lines;
+		/// pool workers and scheduled systems may race to create it, and
+		/// all of them get the one that was published first
+		template <class D>
+		D& state(index_type slot) {
+			void* st = _states[slot].load(std::memory_order_acquire);
+			return *static_cast<D*>(st ? st : create<D>(slot));
 		}
-		static void del(ent_type) {}
-		static T& get(ent_type e) { return _bag[e.id]; }
 	private:
-		static inline Bag<T,Params.InitialEntities> _bag;
+		template <class D>
+		[[gnu::noinline]] void* create(index_type slot) {
+			D* fresh = new (alignedAlloc(sizeof(D), alignof(Registry))) D();
+			void* published = nullptr;
+			if (!_states[slot].compare_exchange_strong(published, fresh, std::memory_order_acq_rel)) {
+				fresh->~D();
+				alignedFree(fresh);
+				return published;
+			}
+			_drops[slot] = [](void* p) {
+				static_cast<D*>(p)->~D();
+				alignedFree(p);
+			};
+			return fresh;
+		}
+
+		std::atomic<void*>	_states[Slots] = {};
+		void	(*_drops[Slots])(void*) = {};
+		tick_type	_tick = 1;
+
+		static Registry			_default;
+		static thread_local Registry*	_current;
+	};
+	inline Registry Registry::_default;
+	inline thread_local Registry* Registry::_current = &Registry::_default;
+
+	template <class T>
+	class SparseStorage final : NoInstance
+	{
+		struct Data {
+			PagedBag<T> bag;
+		};
+	public:
+		/// this storage in the current registry; loops fetch it once
+		static Data& data() { return Registry::current().state<Data>(Component<T>::Index); }
+
+		/// pages hold a live T in every entry, so emplace assigns to it
+		template <class ...Args>
+		static void emplace(ent_type e, Args&&... args) {
+			data().bag.claim(e.id) = T(std::forward<Args>(args)...);
+		}
+		static void add(const ent_type* es, size_type n, const T* ts) {
+			Data& d = data();
+			for (index_type i = 0; i < n; ++i)
+				d.bag.claim(es[i].id) = ts[i];
+		}
+		/// resets the slot, which releases what a non-trivial T holds
+		static void del(ent_type e) {
+			if constexpr (!std::is_trivially_copyable_v<T>)
+				data().bag[e.id] = T();
+		}
+		static void del(const ent_type* es, size_type n) {
+			for (index_type i = 0; i < n; ++i)
+				del(es[i]);
+		}
+		static T& get(ent_type e) { return data().bag[e.id]; }
+
+		/// raw view of d for one loop step: loops re-read it per entity,
+		/// which lets the compiler hoist it when the body cannot grow d
+		struct Cursor { T* const* pages; };
+		static Cursor cursor(Data& d) { return {d.bag.pages()}; }
+		static T& get(const Cursor& c, ent_type e) { return PagedBag<T>::at(c.pages, e.id); }
 	};
 	template <class T>
 	class PackedStorage final : NoInstance
 	{
+		struct Data {
+			Bag<T,Params.InitialPackedSize>			comps;
+			PagedBag<index_type>					entToComp;
+			Bag<ent_type,Params.InitialPackedSize>	compToEnt;
+			Bag<tick_type,Params.InitialPackedSize>	ticks;		///< last change of each slot
+			size_type								grouped = 0;	///< owning group prefix
+			size_type								sorted = 0;		///< slots in order, see sort()
+			size_type								groupSorted = 0;	///< see Group::sort()
+		};
 	public:
-		static void add(ent_type e, const T& t) {
-			_entToComp.ensure(e.id);
-			_entToComp[e.id] = _comps.size();
-			_comps.push(t);
-			_compToEnt.push(e);
+		/// this storage in the current registry; loops fetch it once
+		static Data& data() { return Registry::current().state<Data>(Component<T>::Index); }
+
+		template <class ...Args>
+		static void emplace(ent_type e, Args&&... args) {
+			Data& d = data();
+			d.entToComp.claim(e.id) = d.comps.size();
+			d.comps.emplace(std::forward<Args>(args)...);
+			d.compToEnt.push(e);
+			d.ticks.push(Registry::current().tick());
+		}
+		static void add(const ent_type* es, size_type n, const T* ts) {
+			Data& d = data();
+			for (index_type i = 0; i < n; ++i)
+				d.entToComp.claim(es[i].id) = d.comps.size()+i;
+			d.comps.push(ts, n);
+			d.compToEnt.push(es, n);
+			const tick_type now = Registry::current().tick();
+			d.ticks.ensure(d.ticks.size() + n);
+			for (index_type i = 0; i < n; ++i)
+				d.ticks.push(now);
 		}
 		static void del(ent_type e) {
-			index_type ent_comp_idx = _entToComp[e.id];
-			ent_type last_ent = _compToEnt.pop();
+			Data& d = data();
+			index_type ent_comp_idx = d.entToComp[e.id];
+			ent_type last_ent = d.compToEnt.pop();
 
-			_comps[ent_comp_idx] = _comps.pop();
-			_compToEnt[ent_comp_idx] = last_ent;
-			_entToComp[last_ent.id] = ent_comp_idx;
+			const index_type last = d.comps.size()-1;
+			if (ent_comp_idx != last)
+				d.comps[ent_comp_idx] = std::move(d.comps[last]);
+			d.comps.truncate(last);
+			d.ticks[ent_comp_idx] = d.ticks.pop();
+			d.compToEnt[ent_comp_idx] = last_ent;
+			d.entToComp[last_ent.id] = ent_comp_idx;
+			d.sorted = std::min(d.sorted, ent_comp_idx);
+		}
+		/// Removes all of es in one pass that compacts the slots from the
+		/// first removed one on, keeping the survivors in order.
+		static void del(const ent_type* es, size_type n) {
+			if (n <= 1) {
+				if (n == 1)
+					del(es[0]);
+				return;
+			}
+			Data& d = data();
+			index_type first = d.comps.size();
+			for (index_type i = 0; i < n; ++i) {
+				const index_type idx = d.entToComp[es[i].id];
+				d.compToEnt[idx].id = -1;
+				first = std::min(first, idx);
+			}
+			index_type kept = first;
+			for (index_type i = first; i < d.comps.size(); ++i) {
+				const ent_type e = d.compToEnt[i];
+				if (e.id < 0)
+					continue;
+				d.comps[kept] = std::move(d.comps[i]);
+				d.ticks[kept] = d.ticks[i];
+				d.compToEnt[kept] = e;
+				d.entToComp[e.id] = kept++;
+			}
+			d.comps.truncate(kept);
+			d.compToEnt.truncate(kept);
+			d.ticks.truncate(kept);
+			d.sorted = std::min(d.sorted, first);
 		}
 		static T& get(ent_type e) {
-			return _comps[_entToComp[e.id]];
+			Data& d = data();
+			return d.comps[d.entToComp[e.id]];
 		}
-		static int size() { return _comps.size(); }
+		/// get() for writing: stamps e's T with the current tick
+		static T& patch(ent_type e) {
+			Data& d = data();
+			const index_type idx = d.entToComp[e.id];
+			d.ticks[idx] = Registry::current().tick();
+			return d.comps[idx];
+		}
+		/// the tick of the last add or patch of e's T
+		static tick_type changedAt(ent_type e) {
+			Data& d = data();
+			return d.ticks[d.entToComp[e.id]];
+		}
+		static int size() { return data().comps.size(); }
 		static T& get(index_type idx) {
-			return _comps[idx];
+			return data().comps[idx];
 		}
-		static ent_type entity(index_type idx) {
-			return _compToEnt[idx];
+		static ent_type entity(index_type idx) { return entity(data(), idx); }
+		static index_type index(ent_type e) { return index(data(), e); }
+
+		static size_type size(const Data& d) { return d.comps.size(); }
+		static ent_type entity(const Data& d, index_type idx) {
+			return d.compToEnt[idx];
 		}
-	private:
-		static inline Bag<T,Params.InitialPackedSize>			_comps;
-		static inline Bag<index_type,Params.InitialEntities>	_entToComp;
-		static inline Bag<ent_type,Params.InitialPackedSize>	_compToEnt;
+		static index_type index(const Data& d, ent_type e) {
+			return d.entToComp[e.id];
+		}
+		static void swap(Data& d, index_type i, index_type j) {
+			if (i == j)
+				return;
+			std::swap(d.comps[i], d.comps[j]);
+			std::swap(d.ticks[i], d.ticks[j]);
+			const ent_type a = d.compToEnt[i], b = d.compToEnt[j];
+			d.compToEnt[i] = b;
+			d.compToEnt[j] = a;
+			d.entToComp[a.id] = j;
+			d.entToComp[b.id] = i;
+		}
+
+		/// Restores locality lost to swap-removals: insertion-sorts the slots
+		/// past the group prefix by cmp(ent_type, ent_type) for about budget,
+		/// resuming where the last call stopped. Keep passing the same cmp
+		/// until it returns true.
+		template <class Compare = IdOrder>
+		static bool sort(Compare cmp = {}, std::chrono::microseconds budget = std::chrono::microseconds::max()) {
+			Data& d = data();
+			return insertionSort(d.grouped, size(), d.sorted,
+				[&](index_type i, index_type j) { return cmp(d.compToEnt[i], d.compToEnt[j]); },
+				[&](index_type i, index_type j) { swap(d, i, j); }, budget);
+		}
+		/// sort() into the slot order of Other's storage
+		template <class Other>
+		static bool sortAs(std::chrono::microseconds budget = std::chrono::microseconds::max()) {
+			return sort(StorageOrder<Other>{}, budget);
+		}
+
+		/// raw view of d for one loop step, see SparseStorage::Cursor
+		struct Cursor {
+			T*					comps;
+			index_type* const*	entToComp;
+		};
+		static Cursor cursor(Data& d) { return {d.comps.data(), d.entToComp.pages()}; }
+		static T& get(const Cursor& c, ent_type e) { return c.comps[PagedBag<index_type>::at(c.entToComp, e.id)]; }
+		static T& get(const Cursor& c, index_type idx) { return c.comps[idx]; }
+		static bool changedSince(const Data& d, index_type idx, tick_type since) { return d.ticks[idx] > since; }
+		/// patch() for loops handed t by a View: stamps t's slot of d with
+		/// `now`, both fetched once before the loop
+		static void stamp(Data& d, const T& t, tick_type now) { d.ticks[index_type(&t - d.comps.data())] = now; }
 	};
+	/// Storage of an empty tag type: a bitset over ids answers has(e) and a
+	/// packed id list lets a View driven by the tag visit the tagged
+	/// entities only. Views leave tags out of the callback arguments, so
+	/// View<Pos, Tag> calls f(e, Pos&).
 	template <class T>
 	class TaggedStorage final : NoInstance
 	{
+		static_assert(std::is_empty_v<T>, "tags carry no data");
+		using word_type = std::uint64_t;
+		static constexpr size_type WordBits = 64;
+
+		struct Data {
+			Bag<word_type,(Params.InitialEntities+WordBits-1)/WordBits>	bits;
+			PagedBag<index_type>					entToComp;
+			Bag<ent_type,Params.InitialPackedSize>	compToEnt;
+		};
 	public:
-		static void add(ent_type, const T&) {}
-		static void del(ent_type) {}
+		/// this storage in the current registry; loops fetch it once
+		static Data& data() { return Registry::current().state<Data>(Component<T>::Index); }
+
+		template <class ...Args>
+		static void emplace(ent_type e, Args&&...) {
+			Data& d = data();
+			if (has(d, e))
+				return;
+			cover(d, e.id);
+			d.bits[e.id/WordBits] |= word_type{1} << e.id%WordBits;
+			d.entToComp.claim(e.id) = d.compToEnt.size();
+			d.compToEnt.push(e);
+		}
+		static void add(const ent_type* es, size_type n, const T*) {
+			for (index_type i = 0; i < n; ++i)
+				emplace(es[i]);
+		}
+		static void del(ent_type e) {
+			Data& d = data();
+			if (!has(d, e))
+				return;
+			d.bits[e.id/WordBits] &= ~(word_type{1} << e.id%WordBits);
+			const index_type idx = d.entToComp[e.id];
+			const ent_type last = d.compToEnt.pop();
+			d.compToEnt[idx] = last;
+			d.entToComp[last.id] = idx;
+		}
+		static void del(const ent_type* es, size_type n) {
+			for (index_type i = 0; i < n; ++i)
+				del(es[i]);
+		}
 		static T& get(ent_type) = delete;
+
+		static bool has(ent_type e) { return has(data(), e); }
+		static int size() { return data().compToEnt.size(); }
+		static ent_type entity(index_type idx) { return entity(data(), idx); }
+		static index_type index(ent_type e) { return index(data(), e); }
+
+		static bool has(const Data& d, ent_type e) {
+			const index_type w = e.id/WordBits;
+			return w < d.bits.size() && (d.bits[w] >> e.id%WordBits & 1);
+		}
+		static size_type size(const Data& d) { return d.compToEnt.size(); }
+		static ent_type entity(const Data& d, index_type idx) { return d.compToEnt[idx]; }
+		static index_type index(const Data& d, ent_type e) { return d.entToComp[e.id]; }
+
+		/// nothing to reach per entity, see SparseStorage::Cursor
+		struct Cursor {};
+		static Cursor cursor(const Data&) { return {}; }
+	private:
+		/// grows the bitset to cover id, clearing the new words
+		static void cover(Data& d, id_type id) {
+			const size_type old = d.bits.size(), words = id/WordBits+1;
+			if (words <= old)
+				return;
+			d.bits.resize(words);
+			for (index_type w = old; w < words; ++w)
+				d.bits[w] = 0;
+		}
+	};
+
+
+	/// Lists the fields SoAStorage<T> splits T into:
+	///		template <> struct SoAFields<T> {
+	///			static constexpr auto list = std::make_tuple(&T::a, &T::b);
+	///		};
+	template <class T> struct SoAFields;
+	template <class M> struct FieldOf;
+	template <class C, class F> struct FieldOf<F C::*> { using type = F; };
+
+	/// Stands in for T& on SoAStorage: converts to T, assigns from T, and
+	/// reaches a single field through get<&T::field>().
+	template <class T>
+	class SoARef
+	{
+	public:
+		SoARef(index_type idx) : _idx(idx) {}
+
+		operator T() const { return SoAStorage<T>::load(_idx); }
+		const SoARef& operator=(const T& t) const {
+			SoAStorage<T>::store(_idx, t);
+			return *this;
+		}
+		template <auto M> auto& get() const {
+			return SoAStorage<T>::template field<M>()[_idx];
+		}
+	private:
+		index_type _idx;
+	};
+
+	/// Packed storage with one Alignment-aligned array per field listed in
+	/// SoAFields<T>, so bulk systems can run vectorized loops over a field
+	/// through field<&T::x>(). get(e) returns a SoARef<T> proxy.
+	template <class T>
+	class SoAStorage final : NoInstance
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "SoA fields are copied bytewise");
+		using Fields = std::remove_const_t<decltype(SoAFields<T>::list)>;
+		static constexpr std::size_t N = std::tuple_size_v<Fields>;
+		template <std::size_t I>
+		using field_type = typename FieldOf<std::tuple_element_t<I,Fields>>::type;
+
+		template <std::size_t ...Is>
+		static std::tuple<field_type<Is>*...> columns(std::index_sequence<Is...>);
+		template <std::size_t ...Is>
+		static constexpr std::size_t rowBytes(std::index_sequence<Is...>) { return (sizeof(field_type<Is>) + ... + 0); }
+		struct Columns {
+			decltype(columns(std::make_index_sequence<N>{})) ptrs{};
+			size_type capacity = 0;
+			~Columns() { std::apply([](auto*... cols) { (alignedFree(cols), ...); }, ptrs); }
+		};
+
+		struct Data {
+			size_type								size = 0;
+			Columns									cols;
+			PagedBag<index_type>					entToComp;
+			Bag<ent_type,Params.InitialPackedSize>	compToEnt;
+			size_type								grouped = 0;	///< owning group prefix
+			size_type								sorted = 0;		///< slots in order, see sort()
+			size_type								groupSorted = 0;	///< see Group::sort()
+		};
+	public:
+		static constexpr std::size_t Alignment = 64;
+
+		/// this storage in the current registry; loops fetch it once
+		static Data& data() { return Registry::current().state<Data>(Component<T>::Index); }
+
+		template <class ...Args>
+		static void emplace(ent_type e, Args&&... args) {
+			Data& d = data();
+			if (d.size == d.cols.capacity)
+				grow();
+			d.entToComp.claim(e.id) = d.size;
+			d.compToEnt.push(e);
+			store(d.size++, T(std::forward<Args>(args)...));
+		}
+		static void add(const ent_type* es, size_type n, const T* ts) {
+			Data& d = data();
+			while (d.size+n > d.cols.capacity)
+				grow();
+			d.compToEnt.push(es, n);
+			forFields([&](auto m, auto* col) {
+				for (index_type i = 0; i < n; ++i)
+					col[d.size+i] = ts[i].*m;
+			});
+			for (index_type i = 0; i < n; ++i)
+				d.entToComp.claim(es[i].id) = d.size+i;
+			d.size += n;
+		}
+		static void del(ent_type e) {
+			Data& d = data();
+			const index_type idx = d.entToComp[e.id];
+			const ent_type last = d.compToEnt.pop();
+			const index_type lastIdx = --d.size;
+			forFields([=](auto, auto* col) { col[idx] = col[lastIdx]; });
+			d.compToEnt[idx] = last;
+			d.entToComp[last.id] = idx;
+			d.sorted = std::min(d.sorted, idx);
+		}
+		/// Removes all of es in one compaction pass, as PackedStorage does.
+		static void del(const ent_type* es, size_type n) {
+			if (n <= 1) {
+				if (n == 1)
+					del(es[0]);
+				return;
+			}
+			Data& d = data();
+			index_type first = d.size;
+			for (index_type i = 0; i < n; ++i) {
+				const index_type idx = d.entToComp[es[i].id];
+				d.compToEnt[idx].id = -1;
+				first = std::min(first, idx);
+			}
+			index_type kept = first;
+			for (index_type i = first; i < d.size; ++i) {
+				const ent_type e = d.compToEnt[i];
+				if (e.id < 0)
+					continue;
+				forFields([=](auto, auto* col) { col[kept] = col[i]; });
+				d.compToEnt[kept] = e;
+				d.entToComp[e.id] = kept++;
+			}
+			d.size = kept;
+			d.compToEnt.resize(kept);
+			d.sorted = std::min(d.sorted, first);
+		}
+		static SoARef<T> get(ent_type e) { return {data().entToComp[e.id]}; }
+		static SoARef<T> get(index_type idx) { return {idx}; }
+		static int size() { return data().size; }
+		static ent_type entity(index_type idx) { return entity(data(), idx); }
+		static index_type index(ent_type e) { return index(data(), e); }
+
+		static size_type size(const Data& d) { return d.size; }
+		static ent_type entity(const Data& d, index_type idx) { return d.compToEnt[idx]; }
+		static index_type index(const Data& d, ent_type e) { return d.entToComp[e.id]; }
+		static void swap(Data& d, index_type i, index_type j) {
+			if (i == j)
+				return;
+			forFields([=](auto, auto* col) { std::swap(col[i], col[j]); });
+			const ent_type a = d.compToEnt[i], b = d.compToEnt[j];
+			d.compToEnt[i] = b;
+			d.compToEnt[j] = a;
+			d.entToComp[a.id] = j;
+			d.entToComp[b.id] = i;
+		}
+
+		/// see PackedStorage::sort()
+		template <class Compare = IdOrder>
+		static bool sort(Compare cmp = {}, std::chrono::microseconds budget = std::chrono::microseconds::max()) {
+			Data& d = data();
+			return insertionSort(d.grouped, d.size, d.sorted,
+				[&](index_type i, index_type j) { return cmp(d.compToEnt[i], d.compToEnt[j]); },
+				[&](index_type i, index_type j) { swap(d, i, j); }, budget);
+		}
+		template <class Other>
+		static bool sortAs(std::chrono::microseconds budget = std::chrono::microseconds::max()) {
+			return sort(StorageOrder<Other>{}, budget);
+		}
+
+		/// raw view of d for one loop step, see SparseStorage::Cursor
+		struct Cursor { index_type* const* entToComp; };
+		static Cursor cursor(const Data& d) { return {d.entToComp.pages()}; }
+		static SoARef<T> get(const Cursor& c, ent_type e) { return {PagedBag<index_type>::at(c.entToComp, e.id)}; }
+		static SoARef<T> get(const Cursor&, index_type idx) { return {idx}; }
+
+		/// column of field M, valid for size() elements
+		template <auto M>
+		static auto* field() {
+			constexpr std::size_t I = indexOf<M>(std::make_index_sequence<N>{});
+			static_assert(I < N, "field is not listed in SoAFields<T>");
+			return std::get<I>(data().cols.ptrs);
+		}
+
+		static T load(index_type idx) {
+			T t{};
+			forFields([&](auto m, auto* col) { t.*m = col[idx]; });
+			return t;
+		}
+		static void store(index_type idx, const T& t) {
+			forFields([&](auto m, auto* col) { col[idx] = t.*m; });
+		}
+
+		/// bytes of one component across all columns
+		static constexpr std::size_t RowBytes = rowBytes(std::make_index_sequence<N>{});
+		/// column of the I-th field of SoAFields, valid for size() elements
+		template <std::size_t I>
+		static auto* column() { return std::get<I>(data().cols.ptrs); }
+		/// Calls f(I, column<I>()) for every field, I as an integral_constant.
+		/// Snapshots copy the columns whole.
+		template <class F>
+		static void eachColumn(F&& f) { eachColumn(f, std::make_index_sequence<N>{}); }
+		/// makes the columns hold at least n components
+		static void reserve(size_type n) {
+			while (data().cols.capacity < n)
+				grow();
+		}
+	private:
+		template <auto M, std::size_t I>
+		static constexpr bool isField() {
+			if constexpr (std::is_same_v<std::tuple_element_t<I,Fields>, decltype(M)>)
+				return std::get<I>(SoAFields<T>::list) == M;
+			else
+				return false;
+		}
+		template <auto M, std::size_t ...Is>
+		static constexpr std::size_t indexOf(std::index_sequence<Is...>) {
+			std::size_t idx = N;
+			((idx = isField<M,Is>() ? Is : idx), ...);
+			return idx;
+		}
+
+		template <class F>
+		static void forFields(F&& f) {
+			forFields(f, std::make_index_sequence<N>{});
+		}
+		template <class F, std::size_t ...Is>
+		static void eachColumn(F& f, std::index_sequence<Is...>) {
+			(f(std::integral_constant<std::size_t, Is>{}, column<Is>()), ...);
+		}
+		template <class F, std::size_t ...Is>
+		static void forFields(F& f, std::index_sequence<Is...>) {
+			auto& ptrs = data().cols.ptrs;
+			(f(std::get<Is>(SoAFields<T>::list), std::get<Is>(ptrs)), ...);
+		}
+
+		static void grow() {
+			Data& d = data();
+			const size_type capacity = std::max(Params.InitialPackedSize, d.cols.capacity*2);
+			forFields([&](auto, auto*& col) {
+				using F = std::remove_reference_t<decltype(*col)>;
+				F* fresh = static_cast<F*>(alignedAlloc(sizeof(F)*capacity, Alignment));
+				if (col)
+					memcpy(fresh, col, sizeof(F)*d.size);
+				alignedFree(col);
+				col = fresh;
+			});
+			d.cols.capacity = capacity;
+		}
+	};
+
+	/// Parent/child links for component T, kept in depth-first order: the
+	/// subtree of e is the contiguous slots [index(e), index(e)+subtreeSize(e))
+	/// and every parent precedes its children, whose slots hold the parent's
+	/// slot inline. propagate() therefore pushes state down all trees in
+	/// one forward sweep. New components start as roots; attach() and
+	/// detach() move a whole subtree as one range, and removing a node
+	/// hands its children to its parent. Structural changes shift the
+	/// slots after them, so they cost O(size()) where PackedStorage swaps.
+	template <class T>
+	class HierarchyStorage final : NoInstance
+	{
+		struct Data {
+			Bag<T,Params.InitialPackedSize>				comps;
+			Bag<ent_type,Params.InitialPackedSize>		compToEnt;
+			Bag<index_type,Params.InitialPackedSize>	parents;	///< parent slot, -1 for roots
+			Bag<size_type,Params.InitialPackedSize>		sizes;		///< subtree size, counting the node
+			PagedBag<index_type>						entToComp;
+			DynamicBag<ent_type,16>						moving;		///< parents by entity while slots move
+		};
+	public:
+		/// this storage in the current registry; loops fetch it once
+		static Data& data() { return Registry::current().state<Data>(Component<T>::Index); }
+
+		template <class ...Args>
+		static void emplace(ent_type e, Args&&... args) {
+			Data& d = data();
+			d.entToComp.claim(e.id) = d.comps.size();
+			d.comps.emplace(std::forward<Args>(args)...);
+			d.compToEnt.push(e);
+			d.parents.push(-1);
+			d.sizes.push(1);
+		}
+		static void add(const ent_type* es, size_type n, const T* ts) {
+			for (index_type i = 0; i < n; ++i)
+				emplace(es[i], ts[i]);
+		}
+		static void del(ent_type e) {
+			Data& d = data();
+			const index_type i = d.entToComp[e.id];
+			for (index_type a = d.parents[i]; a >= 0; a = d.parents[a])
+				--d.sizes[a];
+			saveParents(d, i+1);
+			const ent_type up = d.parents[i] >= 0 ? d.compToEnt[d.parents[i]] : ent_type{-1};
+			for (index_type k = 0; k < d.moving.size(); ++k)
+				if (d.moving[k].id == e.id)
+					d.moving[k] = up;
+			const index_type last = d.comps.size()-1;
+			for (index_type k = i; k < last; ++k) {
+				d.comps[k] = std::move(d.comps[k+1]);
+				d.compToEnt[k] = d.compToEnt[k+1];
+				d.sizes[k] = d.sizes[k+1];
+			}
+			truncate(d, last);
+			relink(d, i);
+		}
+		/// Removes all of es in one pass; every survivor ends up under its
+		/// nearest surviving ancestor.
+		static void del(const ent_type* es, size_type n) {
+			if (n <= 1) {
+				if (n == 1)
+					del(es[0]);
+				return;
+			}
+			Data& d = data();
+			saveParents(d, 0);
+			for (index_type i = 0; i < n; ++i)
+				d.sizes[d.entToComp[es[i].id]] = 0;
+			// parents precede children, so a removed parent is resolved first
+			for (index_type k = 0; k < d.comps.size(); ++k)
+				if (d.parents[k] >= 0 && d.sizes[d.parents[k]] == 0)
+					d.moving[k] = d.moving[d.parents[k]];
+			index_type kept = 0;
+			for (index_type k = 0; k < d.comps.size(); ++k) {
+				if (d.sizes[k] == 0)
+					continue;
+				d.comps[kept] = std::move(d.comps[k]);
+				d.compToEnt[kept] = d.compToEnt[k];
+				d.moving[kept++] = d.moving[k];
+			}
+			truncate(d, kept);
+			relink(d, 0);
+			for (index_type k = 0; k < kept; ++k)
+				d.sizes[k] = 1;
+			for (index_type k = kept-1; k >= 0; --k)
+				if (d.parents[k] >= 0)
+					d.sizes[d.parents[k]] += d.sizes[k];
+		}
+		static T& get(ent_type e) {
+			Data& d = data();
+			return d.comps[d.entToComp[e.id]];
+		}
+		static int size() { return data().comps.size(); }
+		static T& get(index_type idx) { return data().comps[idx]; }
+		static ent_type entity(index_type idx) { return entity(data(), idx); }
+		static index_type index(ent_type e) { return index(data(), e); }
+
+		static size_type size(const Data& d) { return d.comps.size(); }
+		static ent_type entity(const Data& d, index_type idx) { return d.compToEnt[idx]; }
+		static index_type index(const Data& d, ent_type e) { return d.entToComp[e.id]; }
+
+		/// the parent of e, id -1 for a root
+		static ent_type parent(ent_type e) {
+			Data& d = data();
+			const index_type p = d.parents[d.entToComp[e.id]];
+			return p >= 0 ? d.compToEnt[p] : ent_type{-1};
+		}
+		static size_type subtreeSize(ent_type e) {
+			Data& d = data();
+			return d.sizes[d.entToComp[e.id]];
+		}
+
+		/// Makes child, with its subtree, the last child of parent. Fails
+		/// when parent lies in child's subtree.
+		static bool attach(ent_type child, ent_type parent) {
+			Data& d = data();
+			const index_type c = d.entToComp[child.id], p = d.entToComp[parent.id];
+			const size_type n = d.sizes[c];
+			if (p >= c && p < c+n)
+				return false;
+			const index_type to = p + d.sizes[p];
+			for (index_type a = d.parents[c]; a >= 0; a = d.parents[a])
+				d.sizes[a] -= n;
+			for (index_type a = p; a >= 0; a = d.parents[a])
+				d.sizes[a] += n;
+			move(d, c, n, to, parent);
+			return true;
+		}
+		/// Makes e, with its subtree, a root placed after all others.
+		static void detach(ent_type e) {
+			Data& d = data();
+			const index_type c = d.entToComp[e.id];
+			const size_type n = d.sizes[c];
+			for (index_type a = d.parents[c]; a >= 0; a = d.parents[a])
+				d.sizes[a] -= n;
+			move(d, c, n, d.comps.size(), ent_type{-1});
+		}
+		/// Destroys e and every entity below it.
+		static void destroySubtree(ent_type e);
+
+		/// Calls f(const T& parent, T& child) for every child, parents
+		/// before their children, in one forward sweep over the slots.
+		template <class F>
+		static void propagate(F&& f) {
+			Data& d = data();
+			T* comps = d.comps.data();
+			const index_type* parents = d.parents.data();
+			for (index_type i = 0; i < d.comps.size(); ++i)
+				if (parents[i] >= 0)
+					f(static_cast<const T&>(comps[parents[i]]), comps[i]);
+		}
+
+		/// raw view of d for one loop step, see SparseStorage::Cursor
+		struct Cursor {
+			T*					comps;
+			index_type* const*	entToComp;
+		};
+		static Cursor cursor(Data& d) { return {d.comps.data(), d.entToComp.pages()}; }
+		static T& get(const Cursor& c, ent_type e) { return c.comps[PagedBag<index_type>::at(c.entToComp, e.id)]; }
+		static T& get(const Cursor& c, index_type idx) { return c.comps[idx]; }
+	private:
+		/// records the parents of the slots from lo on as entities
+		static void saveParents(Data& d, index_type lo) {
+			d.moving.clear();
+			for (index_type k = lo; k < d.comps.size(); ++k)
+				d.moving.push(d.parents[k] >= 0 ? d.compToEnt[d.parents[k]] : ent_type{-1});
+		}
+		/// rebuilds the index and parent slots from lo on after slots moved
+		static void relink(Data& d, index_type lo) {
+			for (index_type k = lo; k < d.comps.size(); ++k)
+				d.entToComp[d.compToEnt[k].id] = k;
+			for (index_type k = lo; k < d.comps.size(); ++k) {
+				const ent_type p = d.moving[k-lo];
+				d.parents[k] = p.id >= 0 ? d.entToComp[p.id] : -1;
+			}
+		}
+		static void truncate(Data& d, size_type n) {
+			d.comps.truncate(n);
+			d.compToEnt.truncate(n);
+			d.parents.truncate(n);
+			d.sizes.truncate(n);
+		}
+		/// moves the n slots from `from` to before slot `to`, as a rotation
+		/// of the range between them
+		static void move(Data& d, index_type from, size_type n, index_type to, ent_type parent) {
+			const index_type lo = std::min(from, to), hi = std::max(from+n, to);
+			const index_type mid = from < to ? from+n : from;
+			saveParents(d, lo);
+			d.moving[from-lo] = parent;
+			std::rotate(d.comps.data()+lo, d.comps.data()+mid, d.comps.data()+hi);
+			std::rotate(d.compToEnt.data()+lo, d.compToEnt.data()+mid, d.compToEnt.data()+hi);
+			std::rotate(d.sizes.data()+lo, d.sizes.data()+mid, d.sizes.data()+hi);
+			std::rotate(d.moving.data(), d.moving.data()+mid-lo, d.moving.data()+hi-lo);
+			relink(d, lo);
+		}
 	};
 
 	template <class T>
@@ -161,19 +1281,37 @@ namespace bagel
 		using type = SparseStorage<T>;
 	};
 
+	template <class S> struct IsPacked : std::false_type {};
+	template <class T> struct IsPacked<PackedStorage<T>> : std::true_type {};
+	template <class T> struct IsPacked<SoAStorage<T>> : std::true_type {};
+	/// storages that stamp each slot with its last change tick
+	template <class S> struct IsTicked : std::false_type {};
+	template <class T> struct IsTicked<PackedStorage<T>> : std::true_type {};
+	template <class S> struct IsTag : std::false_type {};
+	template <class T> struct IsTag<TaggedStorage<T>> : std::true_type {};
+	template <class S> struct IsHierarchy : std::false_type {};
+	template <class T> struct IsHierarchy<HierarchyStorage<T>> : std::true_type {};
+	/// storages that list their entities densely, so a View can walk them
+	template <class S> struct IsDense :
+		std::bool_constant<IsPacked<S>::value || IsTag<S>::value || IsHierarchy<S>::value> {};
+
 	class SingleMask final
 	{
 	public:
 		using bit_type = mask_type;
-		static constexpr bit_type bit(index_type idx) { return 1<<idx; }
+		static constexpr bit_type bit(index_type idx) { return mask_type{1}<<idx; }
 
-		void set(const bit_type b) { _mask |= b; }
+		constexpr void set(const bit_type b) { _mask |= b; }
 
 		void clear(const bit_type b) { _mask &= ~b; }
 		void clear() { _mask = 0; }
 
-		bool test(const bit_type b) const { return _mask & b; }
-		bool test(const SingleMask m) const { return (_mask & m._mask) == m._mask; }
+		constexpr bool test(const bit_type b) const { return _mask & b; }
+		constexpr bool test(const SingleMask m) const { return (_mask & m._mask) == m._mask; }
+		constexpr bool testAny(const SingleMask m) const { return _mask & m._mask; }
+		constexpr bool operator==(const SingleMask m) const { return _mask == m._mask; }
+
+		constexpr mask_type word() const { return _mask; }
 	private:
 		mask_type	_mask{0};
 	};
@@ -185,62 +1323,952 @@ namespace bagel
 			const mask_type		mask;
 		};
 		static constexpr bit_type bit(index_type idx) {
-			return {idx/BitsetWidth, static_cast<mask_type>(1<<(idx%BitsetWidth))};
+			return {idx/BitsetWidth, static_cast<mask_type>(mask_type{1}<<(idx%BitsetWidth))};
 		}
 
-		void set(const bit_type& b) { _masks[b.index] |= b.mask; }
+		constexpr void set(const bit_type& b) { _masks[b.index] |= b.mask; }
 
 		void clear(const bit_type& b) { _masks[b.index] &= ~b.mask; }
 		void clear() { memset(_masks, 0, sizeof(_masks)); }
 
-		bool test(const bit_type& b) const { return _masks[b.index] & b.mask; }
-		bool test(const MultiMask& m) const {
+		constexpr bool test(const bit_type& b) const { return _masks[b.index] & b.mask; }
+		constexpr bool test(const MultiMask& m) const {
 			for (index_type i = 0; i < Size; ++i)
 				if ((_masks[i] & m._masks[i]) != m._masks[i])
 					return false;
 			return true;
 		}
+		constexpr bool testAny(const MultiMask& m) const {
+			for (index_type i = 0; i < Size; ++i)
+				if (_masks[i] & m._masks[i])
+					return true;
+			return false;
+		}
+		constexpr bool operator==(const MultiMask& m) const {
+			for (index_type i = 0; i < Size; ++i)
+				if (_masks[i] != m._masks[i])
+					return false;
+			return true;
+		}
 	private:
 		static constexpr size_type	Size = (Params.MaxComponents-1)/BitsetWidth + 1;
 		mask_type					_masks[Size] ={};
 	};
 	using Mask = std::conditional_t<Params.MaxComponents<=BitsetWidth, SingleMask, MultiMask>;
 
-	static inline index_type compCounter = -1;
-	template <class>
+	inline index_type compCounter = -1;
+	/// Numbers an unlisted component after the `listed` ones. An index past
+	/// Params.MaxComponents would alias the registry's WorldSlot and shift
+	/// out of the mask, so running out of components aborts.
+	inline index_type nextComponentIndex(size_type listed) {
+		const index_type i = listed + ++compCounter;
+		if (i >= Params.MaxComponents) {
+			fprintf(stderr, "bagel: more than Params.MaxComponents (%d) components\n", Params.MaxComponents);
+			std::abort();
+		}
+		return i;
+	}
+	template <class T, bool>
 	struct Component final : NoInstance
 	{
-		static inline const index_type		Index = ++compCounter;
+		static_assert(!Params.TrivialComponents || std::is_trivially_copyable_v<T>,
+			"Params.TrivialComponents rejects components that are not trivially copyable");
+		static inline const index_type		Index = nextComponentIndex(ComponentList<std::void_t<T>>::Size);
 		static inline const Mask::bit_type	Bit = Mask::bit(Index);
 	};
+	/// a component in ComponentList<>
+	template <class T>
+	struct Component<T, true> final : NoInstance
+	{
+		static_assert(!Params.TrivialComponents || std::is_trivially_copyable_v<T>,
+			"Params.TrivialComponents rejects components that are not trivially copyable");
+		static constexpr index_type			Index = ComponentList<std::void_t<T>>::template indexOf<T>();
+		static constexpr Mask::bit_type		Bit = Mask::bit(Index);
+	};
 
-	class World final : NoInstance
+	/// Column-wise presence: for every component index, one bit per entity
+	/// id plus a summary level with one bit per non-empty 64-bit word, so a
+	/// summary word covers 4096 ids. Multi-component queries AND the
+	/// columns word by word and skip empty 4096-id blocks entirely.
+	class Presence final : NoInstance
 	{
 	public:
-		static ent_type createEntity() {
-			if (_ids.size() > 0)
-				return _ids.pop();
-			_masks.push(Mask{});
-			return {++_maxId.id};
+		static void set(index_type comp, ent_type e) {
+			Data& d = data();
+			const index_type w = e.id/64;
+			grow(d.words[comp], w+1);
+			grow(d.summary[comp], w/64+1);
+			d.words[comp][w] |= std::uint64_t{1} << e.id%64;
+			d.summary[comp][w/64] |= std::uint64_t{1} << w%64;
 		}
-		static void destroyEntity(ent_type ent) {
-			_masks[ent.id].clear();
-			_ids.push(ent);
+		static void set(index_type comp, const ent_type* es, size_type n) {
+			Data& d = data();
+			const index_type last = highestId(es, n)/64;
+			grow(d.words[comp], last+1);
+			grow(d.summary[comp], last/64+1);
+			for (index_type i = 0; i < n; ++i) {
+				const index_type w = es[i].id/64;
+				d.words[comp][w] |= std::uint64_t{1} << es[i].id%64;
+				d.summary[comp][w/64] |= std::uint64_t{1} << w%64;
+			}
 		}
-		static const Mask& mask(ent_type e) {
-			return _masks[e.id];
+		static void clear(index_type comp, ent_type e) {
+			Data& d = data();
+			const index_type w = e.id/64;
+			if (w >= d.words[comp].size())
+				return;
+			if (!(d.words[comp][w] &= ~(std::uint64_t{1} << e.id%64)))
+				d.summary[comp][w/64] &= ~(std::uint64_t{1} << w%64);
+		}
+		static bool test(index_type comp, ent_type e) {
+			Data& d = data();
+			const index_type w = e.id/64;
+			return w < d.words[comp].size() && (d.words[comp][w] >> e.id%64 & 1);
 		}
-		static ent_type maxId() { return _maxId; }
 
-		template <class T>
-		static T& getComponent(ent_type e) {
+		/// comp's id bits with one summary bit per nonzero word, as stored
+		struct Column {
+			const std::uint64_t*	words;
+			size_type				size;
+			const std::uint64_t*	summary;
+			size_type				blocks;
+		};
+		static Column column(index_type comp) {
+			Data& d = data();
+			return {d.words[comp].data(), d.words[comp].size(), d.summary[comp].data(), d.summary[comp].size()};
+		}
+		/// resizes comp's column for writing it in place, see Column
+		static std::pair<std::uint64_t*, std::uint64_t*> resize(index_type comp, size_type size, size_type blocks) {
+			Data& d = data();
+			d.words[comp].resize(size);
+			d.summary[comp].resize(blocks);
+			return {d.words[comp].data(), d.summary[comp].data()};
+		}
+		/// replaces comp's column by a copy of c
+		static void assign(index_type comp, const Column& c) {
+			Data& d = data();
+			d.words[comp].clear();
+			d.words[comp].push(c.words, c.size);
+			d.summary[comp].clear();
+			d.summary[comp].push(c.summary, c.blocks);
+		}
+
+		/// calls f(ent_type) for every entity present in all of comps[0..n)
+		template <class F>
+		static void each(const index_type* comps, size_type n, F&& f) {
+			Data& d = data();
+			size_type blocks = d.summary[comps[0]].size();
+			for (index_type i = 1; i < n; ++i)
+				blocks = std::min(blocks, d.summary[comps[i]].size());
+
+			for (index_type b = 0; b < blocks; ++b) {
+				std::uint64_t summary = d.summary[comps[0]][b];
+				for (index_type i = 1; i < n && summary; ++i)
+					summary &= d.summary[comps[i]][b];
+				for (; summary; summary &= summary-1) {
+					const index_type w = b*64 + __builtin_ctzll(summary);
+					std::uint64_t bits = d.words[comps[0]][w];
+					for (index_type i = 1; i < n; ++i)
+						bits &= d.words[comps[i]][w];
+					for (; bits; bits &= bits-1)
+						f(ent_type{w*64 + __builtin_ctzll(bits)});
+				}
+			}
+		}
+	private:
+		template <class B>
+		static void grow(B& bag, size_type n) {
+			bag.ensure(n);
+			while (bag.size() < n)
+				bag.push(0);
+		}
+
+		struct Data {
+			Bag<std::uint64_t,Params.InitialEntities/64+1>		words[Params.MaxComponents];
+			Bag<std::uint64_t,Params.InitialEntities/4096+1>	summary[Params.MaxComponents];
+		};
+		static Data& data() { return Registry::current().state<Data>(Registry::PresenceSlot); }
+	};
+
+	/// Entities whose archetype-stored components are the same set live
+	/// together in fixed-size chunks, one column per component.
+	/// Adding or removing such a component moves the entity's row to the
+	/// archetype of its new set, found through cached add/del edges.
+	class Archetypes final : NoInstance
+	{
+	public:
+		struct Archetype : NoCopy
+		{
+			Mask		mask;
+			index_type	offset[Params.MaxComponents];	///< column start in a chunk, -1 if absent
+			index_type	addEdge[Params.MaxComponents];
+			index_type	delEdge[Params.MaxComponents];
+			size_type	stride[Params.MaxComponents];	///< bytes per row of each column
+			size_type	rowsPerChunk = 0;
+			size_type	chunkBytes = 0;
+			size_type	size = 0;
+			DynamicBag<unsigned char*,4> chunks;
+
+			ent_type* entities(unsigned char* chunk) const {
+				return reinterpret_cast<ent_type*>(chunk);
+			}
+			template <class T>
+			T* column(unsigned char* chunk) const {
+				return reinterpret_cast<T*>(chunk + offset[Component<T>::Index]);
+			}
+			unsigned char* at(index_type row, index_type comp) const {
+				return chunks[row / rowsPerChunk] + offset[comp] + (row % rowsPerChunk)*stride[comp];
+			}
+
+			~Archetype() {
+				for (index_type i = 0; i < chunks.size(); ++i)
+					free(chunks[i]);
+			}
+		};
+
+		static size_type count() { return data().archs.list.size(); }
+		static const Archetype& get(index_type a) { return *data().archs.list[a]; }
+
+		template <class T>
+		static T* find(ent_type e) {
+			Data& d = data();
+			if (e.id >= d.locs.size() || d.locs[e.id].arch < 0)
+				return nullptr;
+			const Location& l = d.locs[e.id];
+			const Archetype& a = *d.archs.list[l.arch];
+			const index_type comp = Component<T>::Index;
+			if (a.offset[comp] < 0)
+				return nullptr;
+			return reinterpret_cast<T*>(a.at(l.row, comp));
+		}
+
+		template <class T>
+		static void add(ent_type e, const T& t) {
+			static_assert(std::is_trivially_copyable_v<T>,
+				"archetype components are moved between chunks bytewise");
+			Data& d = data();
+			const index_type comp = Component<T>::Index;
+			d.sizes[comp] = sizeof(T);
+			d.aligns[comp] = alignof(T);
+
+			while (d.locs.size() <= e.id)
+				d.locs.push({-1,-1});
+			Location& l = d.locs[e.id];
+			if (l.arch < 0) {
+				if (d.rootEdge[comp] == 0)
+					d.rootEdge[comp] = findArchetype(Mask{}, comp, true) + 1;
+				move(e, d.rootEdge[comp] - 1);
+			}
+			else if (d.archs.list[l.arch]->offset[comp] < 0)
+				move(e, edge(l.arch, comp, true));
+			*find<T>(e) = t;
+		}
+		template <class T>
+		static void del(ent_type e) {
+			Data& d = data();
+			const index_type comp = Component<T>::Index;
+			if (e.id >= d.locs.size() || d.locs[e.id].arch < 0)
+				return;
+			const Location& l = d.locs[e.id];
+			if (d.archs.list[l.arch]->offset[comp] >= 0)
+				move(e, edge(l.arch, comp, false));
+		}
+		static void remove(ent_type e) {
+			Data& d = data();
+			if (e.id < d.locs.size() && d.locs[e.id].arch >= 0)
+				move(e, -1);
+		}
+	private:
+		struct Location { index_type arch, row; };
+		struct Table {
+			DynamicBag<Archetype*,8> list;
+			~Table() {
+				for (index_type i = 0; i < list.size(); ++i)
+					delete list[i];
+			}
+		};
+
+		static index_type edge(index_type from, index_type comp, bool add) {
+			Data& d = data();
+			Archetype& a = *d.archs.list[from];
+			index_type& to = add ? a.addEdge[comp] : a.delEdge[comp];
+			if (to == -2)
+				to = findArchetype(a.mask, comp, add);
+			return to;
+		}
+
+		static index_type findArchetype(Mask m, index_type comp, bool add) {
+			if (add)
+				m.set(Mask::bit(comp));
+			else
+				m.clear(Mask::bit(comp));
+			if (m == Mask{})
+				return -1;
+			Data& d = data();
+			for (index_type i = 0; i < d.archs.list.size(); ++i)
+				if (d.archs.list[i]->mask == m)
+					return i;
+
+			Archetype* a = new Archetype;
+			a->mask = m;
+			size_type rowBytes = sizeof(ent_type), padding = 0;
+			for (index_type c = 0; c < Params.MaxComponents; ++c) {
+				a->offset[c] = -1;
+				a->addEdge[c] = a->delEdge[c] = -2;
+				a->stride[c] = d.sizes[c];
+				if (m.test(Mask::bit(c))) {
+					a->offset[c] = 0;
+					rowBytes += d.sizes[c];
+					padding += d.aligns[c];
+				}
+			}
+			a->rowsPerChunk = std::max(1, (Params.ChunkSize-padding) / rowBytes);
+
+			size_type offset = a->rowsPerChunk * sizeof(ent_type);
+			for (index_type c = 0; c < Params.MaxComponents; ++c) {
+				if (a->offset[c] < 0)
+					continue;
+				offset = (offset + d.aligns[c]-1) / d.aligns[c] * d.aligns[c];
+				a->offset[c] = offset;
+				offset += a->rowsPerChunk * d.sizes[c];
+			}
+			a->chunkBytes = offset;
+			d.archs.list.push(a);
+			return d.archs.list.size()-1;
+		}
+
+		/// moves e's row to archetype `to` (or drops it when -1), copying
+		/// the columns both archetypes share
+		static void move(ent_type e, index_type to) {
+			Data& d = data();
+			Location& l = d.locs[e.id];
+			index_type row = -1;
+			if (to >= 0) {
+				Archetype& dst = *d.archs.list[to];
+				row = dst.size++;
+				if (row == dst.chunks.size() * dst.rowsPerChunk)
+					dst.chunks.push(static_cast<unsigned char*>(malloc(dst.chunkBytes)));
+				unsigned char* chunk = dst.chunks[row / dst.rowsPerChunk];
+				dst.entities(chunk)[row % dst.rowsPerChunk] = e;
+				if (l.arch >= 0) {
+					const Archetype& src = *d.archs.list[l.arch];
+					for (index_type c = 0; c < Params.MaxComponents; ++c)
+						if (dst.offset[c] >= 0 && src.offset[c] >= 0)
+							memcpy(dst.at(row, c), src.at(l.row, c), d.sizes[c]);
+				}
+			}
+			if (l.arch >= 0)
+				erase(*d.archs.list[l.arch], l.row);
+			l = {to, row};
+		}
+
+		/// swap-removes a row, moving the archetype's last row into it
+		static void erase(Archetype& a, index_type row) {
+			Data& d = data();
+			const index_type last = --a.size;
+			if (row != last) {
+				for (index_type c = 0; c < Params.MaxComponents; ++c)
+					if (a.offset[c] >= 0)
+						memcpy(a.at(row, c), a.at(last, c), d.sizes[c]);
+				const ent_type moved =
+					a.entities(a.chunks[last / a.rowsPerChunk])[last % a.rowsPerChunk];
+				a.entities(a.chunks[row / a.rowsPerChunk])[row % a.rowsPerChunk] = moved;
+				d.locs[moved.id].row = row;
+			}
+		}
+
+		struct Data {
+			size_type						sizes[Params.MaxComponents] = {};
+			size_type						aligns[Params.MaxComponents] = {};
+			index_type						rootEdge[Params.MaxComponents] = {};	///< archetype+1, 0 if unknown
+			Table							archs;
+			Bag<Location,Params.InitialEntities>	locs;
+		};
+		static Data& data() { return Registry::current().state<Data>(Registry::ArchetypesSlot); }
+	};
+
+	template <class T>
+	class ArchetypeStorage final : NoInstance
+	{
+	public:
+		template <class ...Args>
+		static void emplace(ent_type e, Args&&... args) { Archetypes::add(e, T(std::forward<Args>(args)...)); }
+		static void add(const ent_type* es, size_type n, const T* ts) {
+			for (index_type i = 0; i < n; ++i)
+				Archetypes::add(es[i], ts[i]);
+		}
+		static void del(ent_type e) { Archetypes::del<T>(e); }
+		static void del(const ent_type* es, size_type n) {
+			for (index_type i = 0; i < n; ++i)
+				Archetypes::del<T>(es[i]);
+		}
+		static T& get(ent_type e) { return *Archetypes::find<T>(e); }
+	};
+	template <class S> struct IsArchetype : std::false_type {};
+	template <class T> struct IsArchetype<ArchetypeStorage<T>> : std::true_type {};
+
+	/// Scoped timing markers for chrome://tracing. Every thread appends to
+	/// its own ring of the last RingSize events without taking a lock, and
+	/// write() exports all rings as trace JSON. A disabled marker costs a
+	/// relaxed load and one well predicted branch, and never reads the clock.
+	class Profiler final : NoInstance
+	{
+	public:
+		static constexpr size_type RingSize = 1 << 14;	///< events kept per thread, a power of two
+
+		struct Event {
+			const char*		name;		///< not copied, use literals
+			std::int64_t	start;		///< ns since the first use of the profiler
+			std::int64_t	duration;	///< ns
+		};
+
+		/// Times its enclosing block on the calling thread.
+		class Scope : NoCopy
+		{
+		public:
+			explicit Scope(const char* name) : _name(enabled() ? name : nullptr) {
+				if (_name)
+					_start = now();
+			}
+			~Scope() {
+				if (_name)
+					record(_name, _start, now() - _start);
+			}
+		private:
+			const char*		_name;
+			std::int64_t	_start = 0;
+		};
+
+		static void enable(bool on) { _enabled.store(on, std::memory_order_relaxed); }
+		static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+		static std::int64_t now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+		}
+
+		/// Adds an event timed elsewhere, such as a library's own profile,
+		/// to the calling thread's ring. Overwrites the oldest when full.
+		static void record(const char* name, std::int64_t start, std::int64_t duration) {
+			Ring& r = ring();
+			const std::uint64_t n = r.count.load(std::memory_order_relaxed);
+			r.events[n & (RingSize-1)] = {name, start, duration};
+			r.count.store(n+1, std::memory_order_release);
+		}
+
+		/// Events held by all rings.
+		static size_type size() {
+			Rings& all = rings();
+			const std::lock_guard<std::mutex> lock(all.m);
+			size_type n = 0;
+			for (const auto& r : all.rings)
+				n += static_cast<size_type>(std::min<std::uint64_t>(r->count.load(std::memory_order_acquire), RingSize));
+			return n;
+		}
+
+		/// Empties the rings. Like write(), call it while no marker runs.
+		static void clear() {
+			Rings& all = rings();
+			const std::lock_guard<std::mutex> lock(all.m);
+			for (const auto& r : all.rings)
+				r->count.store(0, std::memory_order_relaxed);
+		}
+
+		/// Writes every ring as chrome://tracing JSON, one complete event per
+		/// marker with the thread's registration order as its tid. Call it
+		/// between frames, while no thread records.
+		static bool write(const char* path) {
+			FILE* f = fopen(path, "w");
+			if (!f)
+				return false;
+			Rings& all = rings();
+			const std::lock_guard<std::mutex> lock(all.m);
+			fprintf(f, "{\"traceEvents\":[");
+			const char* sep = "\n";
+			for (index_type t = 0; t < static_cast<index_type>(all.rings.size()); ++t) {
+				const Ring& r = *all.rings[t];
+				const std::uint64_t n = r.count.load(std::memory_order_acquire);
+				for (std::uint64_t i = n > RingSize ? n-RingSize : 0; i < n; ++i, sep = ",\n") {
+					const Event& ev = r.events[i & (RingSize-1)];
+					fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+						sep, ev.name, t, ev.start / 1e3, ev.duration / 1e3);
+				}
+			}
+			fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+			return fclose(f) == 0;
+		}
+	private:
+		struct Ring {
+			std::unique_ptr<Event[]>	events{new Event[RingSize]};
+			std::atomic<std::uint64_t>	count{0};	///< events ever recorded, only the owner writes it
+		};
+		// rings outlive their threads so write() still sees finished workers
+		struct Rings {
+			std::mutex							m;
+			std::deque<std::unique_ptr<Ring>>	rings;
+		};
+
+		static Rings& rings() {
+			static Rings all;
+			return all;
+		}
+		static Ring& ring() {
+			thread_local Ring* mine = nullptr;
+			if (!mine) {
+				Rings& all = rings();
+				const std::lock_guard<std::mutex> lock(all.m);
+				all.rings.push_back(std::make_unique<Ring>());
+				mine = all.rings.back().get();
+			}
+			return *mine;
+		}
+
+		static inline std::atomic<bool> _enabled{false};
+		static inline const std::chrono::steady_clock::time_point _epoch = std::chrono::steady_clock::now();
+	};
+
+	/// Batched reactions to component changes. While some observer watches
+	/// T, World appends an event to T's ring buffer whenever T is added,
+	/// removed or patched; deliver() then hands each observer of T all of
+	/// T's events since the last delivery in a single call. Reacting costs
+	/// in proportion to the changes rather than the population.
+	/// Each type has its own ring, and the Scheduler never runs two writers
+	/// of T at once, so systems may patch concurrently; not from inside
+	/// parallelEach though. Events raised while delivering wait for the
+	/// next delivery.
+	class Observers final : NoInstance
+	{
+	public:
+		enum class Kind : std::uint8_t { Added, Removed, Changed };
+		struct Event {
+			ent_type	e;
+			Kind		kind;
+		};
+		/// Removed events arrive after the component is gone
+		using Observer = void (*)(const Event*, size_type);
+
+		static void add(index_type comp, Observer fn) { data().observers[comp].push(fn); }
+		static void record(index_type comp, ent_type e, Kind kind) { data().rings[comp].push({e, kind}); }
+		static size_type pending(index_type comp) { return data().rings[comp].count; }
+
+		/// Drains every ring into its observers. Call it at a sync point,
+		/// outside of any system; observers may change the world freely.
+		static void deliver() {
+			const Profiler::Scope profile("deliver");
+			Data& d = data();
+			for (index_type c = 0; c < Params.MaxComponents; ++c) {
+				Ring& r = d.rings[c];
+				if (r.count == 0)
+					continue;
+				// copied out so observers can record into the ring meanwhile
+				d.batch.clear();
+				for (; r.count > 0; --r.count, r.head = (r.head+1) & (r.capacity-1))
+					d.batch.push(r.events[r.head]);
+				for (index_type o = 0; o < d.observers[c].size(); ++o)
+					d.observers[c][o](d.batch.data(), d.batch.size());
+			}
+		}
+	private:
+		struct Ring {
+			std::unique_ptr<Event[]>	events;
+			size_type					capacity = 0;	///< a power of two
+			index_type					head = 0;
+			size_type					count = 0;
+
+			void push(const Event& ev) {
+				if (count == capacity)
+					grow();
+				events[(head+count++) & (capacity-1)] = ev;
+			}
+			void grow() {
+				const size_type next = capacity ? capacity*2 : 64;
+				std::unique_ptr<Event[]> bigger(new Event[next]);
+				for (index_type i = 0; i < count; ++i)
+					bigger[i] = events[(head+i) & (capacity-1)];
+				events = std::move(bigger);
+				capacity = next;
+				head = 0;
+			}
+		};
+		struct Data {
+			Ring						rings[Params.MaxComponents];
+			DynamicBag<Observer,4>		observers[Params.MaxComponents];
+			DynamicBag<Event,64>		batch;
+		};
+		static Data& data() { return Registry::current().state<Data>(Registry::ObserversSlot); }
+	};
+
+	/// File layout of World::saveSnapshot(): a Header, one Record per
+	/// component of the saved list, then the sections they point at. Every
+	/// section starts 64-byte aligned and holds an array exactly as the
+	/// engine keeps it in memory, so loading maps the file and copies each
+	/// section in one go. Files are only read back by builds with the same
+	/// Params and byte order, which the header checks, and the same list:
+	/// every record holds its component's list index, size, alignment and a
+	/// hash of the compiler's name for the type, so a changed or reordered
+	/// list is rejected. Builds from different compilers name types apart.
+	class Snapshot final : NoInstance
+	{
+	public:
+		static constexpr std::uint32_t Version = 2;
+		static constexpr std::size_t Align = 64;
+
+		struct Section {
+			std::uint64_t	offset;
+			std::uint64_t	bytes;
+		};
+		enum Kind : std::uint32_t { Packed, Sparse, SoA };
+		struct alignas(Align) Header {
+			char			magic[8];
+			std::uint32_t	version;
+			std::uint32_t	maxComponents;
+			std::uint32_t	pageSize;
+			std::uint32_t	maskBytes;
+			std::int32_t	maxId;
+			std::uint32_t	records;
+			Section			masks;
+			Section			ids;		///< the free list
+		};
+		/// one saved storage; a sparse one stores its pages in `values`, an
+		/// SoA one its columns one after the other
+		struct alignas(Align) Record {
+			std::uint32_t	comp;
+			std::uint32_t	kind;
+			std::uint32_t	bytes;		///< sizeof the component
+			std::uint32_t	count;		///< components, or pages when sparse
+			std::uint32_t	align;		///< alignof the component
+			std::uint64_t	type;		///< fingerprint() of the component
+			Section			values;
+			Section			entities;	///< packed slot owners
+			Section			pages;		///< numbers of the id-indexed pages
+			Section			index;		///< packed id to slot pages
+			Section			presence;
+			Section			summary;
+		};
+		static constexpr char Magic[8] = {'B','A','G','E','L','S','N','P'};
+
+		/// components whose storage is a set of raw arrays
+		template <class T>
+		static constexpr bool Savable = std::is_trivially_copyable_v<T> &&
+			(std::is_same_v<typename Storage<T>::type, PackedStorage<T>> ||
+			 std::is_same_v<typename Storage<T>::type, SparseStorage<T>> ||
+			 std::is_same_v<typename Storage<T>::type, SoAStorage<T>>);
+		template <class T>
+		static constexpr Kind kindOf() {
+			using S = typename Storage<T>::type;
+			return std::is_same_v<S, SoAStorage<T>> ? SoA : std::is_same_v<S, PackedStorage<T>> ? Packed : Sparse;
+		}
+
+		/// FNV-1a hash of the compiler's signature of this function, which
+		/// spells out T
+		template <class T>
+		static constexpr std::uint64_t fingerprint() {
+#ifdef _MSC_VER
+			const char* name = __FUNCSIG__;
+#else
+			const char* name = __PRETTY_FUNCTION__;
+#endif
+			std::uint64_t h = 14695981039346656037ull;
+			for (; *name; ++name)
+				h = (h ^ static_cast<unsigned char>(*name)) * 1099511628211ull;
+			return h;
+		}
+	private:
+		template <class T>
+		using Keep = std::conditional_t<Savable<T>, std::tuple<T>, std::tuple<>>;
+		template <class Tuple> struct ListOf;
+		template <class ...Ts> struct ListOf<std::tuple<Ts...>> { using type = Components<Ts...>; };
+		template <class ...Ts>
+		static auto saved(Components<Ts...>) ->
+			typename ListOf<decltype(std::tuple_cat(std::declval<Keep<Ts>>()...))>::type;
+		template <class ...Ts>
+		static constexpr bool listed(Components<Ts...>) { return (IsListed<Ts> && ...); }
+	public:
+		/// the Savable components of the Components list List
+		template <class List>
+		using Saved = decltype(saved(List{}));
+		template <class List>
+		static constexpr bool Listed = listed(List{});
+
+		/// whether no entity holds a component outside Ts
+		template <class ...Ts>
+		static bool covers(Components<Ts...>) {
+			Mask saved;
+			(saved.set(Component<Ts>::Bit), ...);
+			for (index_type c = 0; c < Params.MaxComponents; ++c)
+				if (!saved.test(Mask::bit(c))) {
+					const Presence::Column col = Presence::column(c);
+					for (index_type b = 0; b < col.blocks; ++b)
+						if (col.summary[b])
+							return false;
+				}
+			return true;
+		}
+
+		/// Appends sections to a new file; Header and Records are written
+		/// last into the space reserved for them at the front.
+		class Writer : NoCopy
+		{
+		public:
+			Writer(const char* path, std::size_t front) : _f(fopen(path, "wb")) {
+				static const unsigned char zero[Align] = {};
+				for (std::size_t n = 0; _f && n < front; n += Align)
+					fwrite(zero, 1, std::min(Align, front-n), _f);
+				_at = front;
+			}
+			~Writer() {
+				if (_f)
+					fclose(_f);
+			}
+			bool ok() const { return _f && !ferror(_f); }
+
+			/// starts a section at the next aligned offset
+			Section begin() {
+				static const unsigned char zero[Align] = {};
+				const std::size_t pad = (Align - _at%Align) % Align;
+				fwrite(zero, 1, pad, _f);
+				_at += pad;
+				return {_at, 0};
+			}
+			void append(Section& s, const void* p, std::size_t bytes) {
+				fwrite(p, 1, bytes, _f);
+				_at += bytes;
+				s.bytes += bytes;
+			}
+			Section write(const void* p, std::size_t bytes) {
+				Section s = begin();
+				append(s, p, bytes);
+				return s;
+			}
+			/// writes the front part and closes the file
+			bool finish(const void* front, std::size_t bytes) {
+				if (!ok() || fseek(_f, 0, SEEK_SET) != 0)
+					return false;
+				fwrite(front, 1, bytes, _f);
+				const bool done = !ferror(_f) & (fclose(_f) == 0);
+				_f = nullptr;
+				return done;
+			}
+		private:
+			FILE*			_f;
+			std::size_t		_at;
+		};
+
+		/// A whole file mapped read-only, pages copied in only on access.
+		class Mapping : NoCopy
+		{
+		public:
+			explicit Mapping(const char* path) {
+#ifdef _WIN32
+				const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+				if (file == INVALID_HANDLE_VALUE)
+					return;
+				LARGE_INTEGER size;
+				if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+					if (const HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)) {
+						_p = static_cast<const unsigned char*>(MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0));
+						_size = _p ? static_cast<std::size_t>(size.QuadPart) : 0;
+						CloseHandle(map);
+					}
+				CloseHandle(file);
+#else
+				const int fd = open(path, O_RDONLY);
+				if (fd < 0)
+					return;
+				struct stat st;
+				if (fstat(fd, &st) == 0 && st.st_size > 0) {
+					void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (p != MAP_FAILED) {
+						_p = static_cast<const unsigned char*>(p);
+						_size = static_cast<std::size_t>(st.st_size);
+					}
+				}
+				close(fd);
+#endif
+			}
+			~Mapping() {
+				if (!_p)
+					return;
+#ifdef _WIN32
+				UnmapViewOfFile(_p);
+#else
+				munmap(const_cast<unsigned char*>(_p), _size);
+#endif
+			}
+
+			/// the bytes of s, nullptr when s lies outside the file
+			const void* at(const Section& s) const {
+				return s.offset <= _size && s.bytes <= _size - s.offset ? _p + s.offset : nullptr;
+			}
+			std::size_t size() const { return _size; }
+		private:
+			const unsigned char*	_p = nullptr;
+			std::size_t			_size = 0;
+		};
+	};
+
+	class World final : NoInstance
+	{
+		struct Data {
+			ent_type							maxId{-1};
+			Bag<Mask,		Params.InitialEntities>	masks;
+			Bag<ent_type,	Params.IdBagSize>		ids;
+			/// removes one component type from its storage, set on first add
+			void (*removers[Params.MaxComponents])(const ent_type*, size_type) = {};
+			/// owning group hooks of each component, see Group
+			void (*enter[Params.MaxComponents])(ent_type) = {};
+			void (*leave[Params.MaxComponents])(ent_type) = {};
+			DynamicBag<ent_type,16>				doomed[Params.MaxComponents];
+			Mask								observed;	///< components with observers
+		};
+	public:
+		/// the current registry's entities; loops fetch it once
+		static Data& data() { return Registry::current().state<Data>(Registry::WorldSlot); }
+
+		static ent_type createEntity() {
+			Data& d = data();
+			if (d.ids.size() > 0)
+				return d.ids.pop();
+			d.masks.push(Mask{});
+			return {++d.maxId.id};
+		}
+		/// Creates n entities into out, reusing recycled ids first and
+		/// growing the mask array once for the rest.
+		static void createEntities(size_type n, ent_type* out) {
+			Data& d = data();
+			index_type i = 0;
+			for (; i < n && d.ids.size() > 0; ++i)
+				out[i] = d.ids.pop();
+			d.masks.ensure(d.masks.size() + n-i);
+			for (; i < n; ++i) {
+				d.masks.push(Mask{});
+				out[i] = {++d.maxId.id};
+			}
+		}
+		static void destroyEntity(ent_type ent) {
+			Data& d = data();
+			Archetypes::remove(ent);
+			leaveGroups(d, ent);
+			for (index_type c = 0; c < Params.MaxComponents; ++c)
+				if (d.masks[ent.id].test(Mask::bit(c))) {
+					Presence::clear(c, ent);
+					d.removers[c](&ent, 1);
+					if (d.observed.test(Mask::bit(c)))
+						Observers::record(c, ent, Observers::Kind::Removed);
+				}
+			d.masks[ent.id].clear();
+			d.ids.push(ent);
+		}
+		/// Destroys n distinct entities, removing their components with a
+		/// single batched removal per storage.
+		static void destroyEntities(const ent_type* es, size_type n) {
+			Data& d = data();
+			for (index_type i = 0; i < n; ++i) {
+				Archetypes::remove(es[i]);
+				leaveGroups(d, es[i]);
+				for (index_type c = 0; c < Params.MaxComponents; ++c)
+					if (d.masks[es[i].id].test(Mask::bit(c))) {
+						Presence::clear(c, es[i]);
+						d.doomed[c].push(es[i]);
+						if (d.observed.test(Mask::bit(c)))
+							Observers::record(c, es[i], Observers::Kind::Removed);
+					}
+			}
+			for (index_type c = 0; c < Params.MaxComponents; ++c)
+				if (d.doomed[c].size() > 0) {
+					d.removers[c](d.doomed[c].data(), d.doomed[c].size());
+					d.doomed[c].clear();
+				}
+			for (index_type i = 0; i < n; ++i) {
+				d.masks[es[i].id].clear();
+				d.ids.push(es[i]);
+			}
+		}
+		static const Mask& mask(ent_type e) {
+			return data().masks[e.id];
+		}
+		/// masks indexed by id, valid until the next entity is created
+		static const Mask* masks(const Data& d) { return d.masks.data(); }
+		static ent_type maxId() { return data().maxId; }
+
+		template <class T, class ...Ts, class F>
+		static void each(F&& f);
+		template <class T, class ...Ts, class F>
+		static void parallelEach(F&& f, size_type grain = 1024);
+		/// each() over the entities whose T was added or patched after tick
+		/// `since`; T needs a storage that keeps ticks
+		template <class T, class ...Ts, class F>
+		static void eachChanged(tick_type since, F&& f);
+		template <class ...Ts>
+		static bool group();
+
+		/// Writes every entity and the components of List to path, see
+		/// Snapshot. List names ComponentList components; those kept
+		/// trivially copyable in packed, sparse or SoA storages are saved. Fails
+		/// when an entity holds a component the snapshot would leave out.
+		template <class List = ComponentList<>>
+		static bool saveSnapshot(const char* path);
+		/// Maps a saveSnapshot() file into the current registry, which must
+		/// not have created entities yet. Fails, leaving the registry
+		/// untouched, when the file does not match this build.
+		template <class List = ComponentList<>>
+		static bool loadSnapshot(const char* path);
+
+		/// Pushes into `ids` every entity whose mask holds all bits of `all`,
+		/// at least one bit of `any` (unless empty) and no bit of `none`.
+		/// Entities without components are never matched.
+		/// Returns the number of matches.
+		template <class Ids>
+		static size_type match(const Mask& all, const Mask& any, const Mask& none, Ids& ids) {
+			size_type found = 0;
+			scan(all, any, none, [&](index_type block, std::uint64_t hits) {
+				for (; hits; hits &= hits-1, ++found)
+					ids.push({block*64 + __builtin_ctzll(hits)});
+			});
+			return found;
+		}
+		template <class Ids>
+		static size_type match(const Mask& all, Ids& ids) {
+			return match(all, Mask{}, Mask{}, ids);
+		}
+		/// Same as match(), setting one bit per matching id in `bits`,
+		/// which must hold maxId().id/64+1 words.
+		static size_type matchBits(const Mask& all, const Mask& any, const Mask& none, std::uint64_t* bits) {
+			Data& d = data();
+			size_type found = 0;
+			memset(bits, 0, (d.maxId.id/64+1) * sizeof(std::uint64_t));
+			scan(all, any, none, [&](index_type block, std::uint64_t hits) {
+				bits[block] = hits;
+				found += __builtin_popcountll(hits);
+			});
+			return found;
+		}
+
+		template <class T>
+		static decltype(auto) getComponent(ent_type e) {
 			return Storage<T>::type::get(e);
 		}
 
 		template <class T>
 		static void addComponent(ent_type e, const T& t) {
-			_masks[e.id].set(Component<T>::Bit);
-			Storage<T>::type::add(e,t);
+			emplaceComponent<T>(e, t);
+		}
+		template <class T, class = std::enable_if_t<!std::is_reference_v<T>>>
+		static void addComponent(ent_type e, T&& t) {
+			emplaceComponent<T>(e, std::move(t));
+		}
+		/// Constructs T from args in its storage; packed storages build it
+		/// in place.
+		template <class T, class ...Args>
+		static void emplaceComponent(ent_type e, Args&&... args) {
+			Data& d = data();
+			d.masks[e.id].set(Component<T>::Bit);
+			Presence::set(Component<T>::Index, e);
+			d.removers[Component<T>::Index] = &remover<T>;
+			Storage<T>::type::emplace(e, std::forward<Args>(args)...);
+			if (d.enter[Component<T>::Index])
+				d.enter[Component<T>::Index](e);
+			if (d.observed.test(Component<T>::Bit))
+				Observers::record(Component<T>::Index, e, Observers::Kind::Added);
 		}
 		template <class T, class...Ts>
 		static void addComponents(ent_type e, const T& t, const Ts&... ts) {
@@ -248,11 +2276,34 @@ namespace bagel
 			if constexpr (sizeof...(Ts)>0)
 				addComponents(e, ts...);
 		}
+		/// Adds ts[i] to es[i] for i in [0,n), growing each bag once and
+		/// appending packed components with a single contiguous copy.
+		template <class T>
+		static void addComponents(const ent_type* es, size_type n, const T* ts) {
+			Data& d = data();
+			for (index_type i = 0; i < n; ++i)
+				d.masks[es[i].id].set(Component<T>::Bit);
+			Presence::set(Component<T>::Index, es, n);
+			d.removers[Component<T>::Index] = &remover<T>;
+			Storage<T>::type::add(es, n, ts);
+			if (d.enter[Component<T>::Index])
+				for (index_type i = 0; i < n; ++i)
+					d.enter[Component<T>::Index](es[i]);
+			if (d.observed.test(Component<T>::Bit))
+				for (index_type i = 0; i < n; ++i)
+					Observers::record(Component<T>::Index, es[i], Observers::Kind::Added);
+		}
 
 		template <class T>
 		static void delComponent(ent_type e) {
-			_masks[e.id].clear(Component<T>::Bit);
+			Data& d = data();
+			if (d.leave[Component<T>::Index])
+				d.leave[Component<T>::Index](e);
+			d.masks[e.id].clear(Component<T>::Bit);
+			Presence::clear(Component<T>::Index, e);
 			Storage<T>::type::del(e);
+			if (d.observed.test(Component<T>::Bit))
+				Observers::record(Component<T>::Index, e, Observers::Kind::Removed);
 		}
 		template <class T, class ...Ts>
 		static void delComponents(ent_type e) {
@@ -260,11 +2311,208 @@ namespace bagel
 			if constexpr (sizeof...(Ts)>0)
 				delComponents<Ts...>(e);
 		}
+		/// Removes T from n distinct entities that all hold it, in one
+		/// batched removal.
+		template <class T>
+		static void delComponents(const ent_type* es, size_type n) {
+			Data& d = data();
+			if (d.leave[Component<T>::Index])
+				for (index_type i = 0; i < n; ++i)
+					d.leave[Component<T>::Index](es[i]);
+			for (index_type i = 0; i < n; ++i) {
+				d.masks[es[i].id].clear(Component<T>::Bit);
+				Presence::clear(Component<T>::Index, es[i]);
+			}
+			Storage<T>::type::del(es, n);
+			if (d.observed.test(Component<T>::Bit))
+				for (index_type i = 0; i < n; ++i)
+					Observers::record(Component<T>::Index, es[i], Observers::Kind::Removed);
+		}
+
+		/// e's T for writing: stamps its change tick where the storage
+		/// keeps ticks and records the change for T's observers. Writes
+		/// through getComponent() and views go unnoticed by both.
+		template <class T>
+		static decltype(auto) patch(ent_type e) {
+			if (data().observed.test(Component<T>::Bit))
+				Observers::record(Component<T>::Index, e, Observers::Kind::Changed);
+			using S = typename Storage<T>::type;
+			if constexpr (IsTicked<S>::value)
+				return S::patch(e);
+			else
+				return getComponent<T>(e);
+		}
+		/// Calls f on patch<T>(e).
+		template <class T, class F>
+		static void patch(ent_type e, F&& f) {
+			f(patch<T>(e));
+		}
+		/// Makes fn receive T's add, remove and patch events at every
+		/// deliver(); events start being recorded from this call on.
+		template <class T>
+		static void observe(Observers::Observer fn) {
+			data().observed.set(Component<T>::Bit);
+			Observers::add(Component<T>::Index, fn);
+		}
+		static void deliver() { Observers::deliver(); }
+
+		static tick_type tick() { return Registry::current().tick(); }
+		/// Starts a new tick, typically once per frame. A system that keeps
+		/// the tick() it last ran at sees what changed since through
+		/// eachChanged().
+		static tick_type advanceTick() { return Registry::current().advanceTick(); }
 
 	private:
-		static inline ent_type								_maxId{-1};
-		static inline Bag<Mask,		Params.InitialEntities> _masks;
-		static inline Bag<ent_type,	Params.IdBagSize>		_ids;
+		template <class ...Ts>
+		static bool saveSnapshot(const char* path, Components<Ts...>);
+		template <class ...Ts>
+		static bool loadSnapshot(const char* path, Components<Ts...>);
+		template <class T>
+		static void saveRecord(Snapshot::Writer& w, Snapshot::Record& r);
+		template <class T>
+		static bool checkRecord(const Snapshot::Mapping& m, const Snapshot::Record* rs, std::uint32_t n);
+		template <class T>
+		static void loadRecord(const Snapshot::Mapping& m, const Snapshot::Record* rs, std::uint32_t n);
+
+		template <class T>
+		static void remover(const ent_type* es, size_type n) {
+			Storage<T>::type::del(es, n);
+		}
+		/// takes e out of its owning groups while its storages are intact
+		static void leaveGroups(Data& d, ent_type e) {
+			for (index_type c = 0; c < Params.MaxComponents; ++c)
+				if (d.leave[c] && d.masks[e.id].test(Mask::bit(c)))
+					d.leave[c](e);
+		}
+		/// calls f(block, hits) for each run of 64 ids with any match
+		template <class F>
+		static void scan(const Mask& all, const Mask& any, const Mask& none, F&& f) {
+			Data& d = data();
+			const size_type n = d.masks.size();
+			index_type b = scanWords(all, any, none, f);
+			for (; b*64 < n; ++b) {
+				std::uint64_t hits = 0;
+				for (index_type i = b*64; i < std::min(n, (b+1)*64); ++i) {
+					const Mask& m = d.masks[i];
+					if (m.test(all) && !m.testAny(none) &&
+							(any == Mask{} ? !(m == Mask{}) : m.testAny(any)))
+						hits |= std::uint64_t{1} << (i%64);
+				}
+				if (hits)
+					f(b, hits);
+			}
+		}
+
+		/// word-wise scan of all full blocks, returns the first block left
+		template <class F>
+		static index_type scanWords(const SingleMask& all, const SingleMask& any, const SingleMask& none, F& f) {
+			Data& d = data();
+			static_assert(sizeof(SingleMask) == sizeof(mask_type));
+			const mask_type* w = reinterpret_cast<const mask_type*>(d.masks.data());
+			// an empty any-of mask reduces to "has some component"
+			const mask_type a = all.word(), x = none.word(),
+				o = any == SingleMask{} ? static_cast<mask_type>(~mask_type{0}) : any.word();
+			index_type b = 0;
+			for (; (b+1)*64 <= d.masks.size(); ++b)
+				if (const std::uint64_t hits = scanBlock(w + b*64, a, o, x))
+					f(b, hits);
+			return b;
+		}
+		template <class F>
+		static index_type scanWords(const MultiMask&, const MultiMask&, const MultiMask&, F&) {
+			return 0;
+		}
+
+		static std::uint64_t scanBlock(const mask_type* w, mask_type a, mask_type o, mask_type x) {
+#if defined(__AVX2__)
+			return scanVectors<__m256i>(w, a, o, x);
+#elif defined(__SSE2__)
+			return scanVectors<__m128i>(w, a, o, x);
+#else
+			std::uint64_t hits = 0;
+			for (int i = 0; i < 64; ++i)
+				hits |= static_cast<std::uint64_t>(((w[i]&a) == a) & ((w[i]&x) == 0) & ((w[i]&o) != 0)) << i;
+			return hits;
+#endif
+		}
+#if defined(__SSE2__) || defined(__AVX2__)
+		template <class V>
+		static std::uint64_t scanVectors(const mask_type* w, mask_type a, mask_type o, mask_type x) {
+			constexpr int Lanes = sizeof(V)/sizeof(mask_type);
+			const V zero = splat<V>(0), va = splat<V>(a), vo = splat<V>(o), vx = splat<V>(x);
+			std::uint64_t hits = 0;
+			for (int k = 0; k < 64; k += Lanes) {
+				V v;
+				memcpy(&v, w+k, sizeof(V));
+				// all-of and none-of hold, and the any-of bits are not all clear
+				const V ok = andNot(cmpeq(And(v, vo), zero), And(cmpeq(And(v, va), va), cmpeq(And(v, vx), zero)));
+				hits |= static_cast<std::uint64_t>(laneBits(ok)) << k;
+			}
+			return hits;
+		}
+
+		/// keeps one bit out of every `sizeof(mask_type)` bits of a byte mask
+		static std::uint32_t compressBytes(std::uint32_t m) {
+			if constexpr (sizeof(mask_type) == 2) {
+				m &= 0x55555555;
+				m = (m | m>>1) & 0x33333333;
+				m = (m | m>>2) & 0x0f0f0f0f;
+				m = (m | m>>4) & 0x00ff00ff;
+				m = (m | m>>8) & 0x0000ffff;
+			}
+			return m;
+		}
+
+		template <class V>
+		static V splat(mask_type m) {
+			if constexpr (sizeof(V) == 16) {
+				if constexpr (sizeof(m) == 1) return _mm_set1_epi8(static_cast<char>(m));
+				else if constexpr (sizeof(m) == 2) return _mm_set1_epi16(static_cast<short>(m));
+				else if constexpr (sizeof(m) == 4) return _mm_set1_epi32(static_cast<int>(m));
+				else return _mm_set1_epi64x(static_cast<long long>(m));
+			}
+#ifdef __AVX2__
+			else {
+				if constexpr (sizeof(m) == 1) return _mm256_set1_epi8(static_cast<char>(m));
+				else if constexpr (sizeof(m) == 2) return _mm256_set1_epi16(static_cast<short>(m));
+				else if constexpr (sizeof(m) == 4) return _mm256_set1_epi32(static_cast<int>(m));
+				else return _mm256_set1_epi64x(static_cast<long long>(m));
+			}
+#endif
+		}
+		static __m128i And(__m128i l, __m128i r) { return _mm_and_si128(l, r); }
+		static __m128i andNot(__m128i n, __m128i v) { return _mm_andnot_si128(n, v); }
+		static __m128i cmpeq(__m128i l, __m128i r) {
+			if constexpr (sizeof(mask_type) == 1) return _mm_cmpeq_epi8(l, r);
+			else if constexpr (sizeof(mask_type) == 2) return _mm_cmpeq_epi16(l, r);
+			else if constexpr (sizeof(mask_type) == 4) return _mm_cmpeq_epi32(l, r);
+			else {
+				// no 64-bit compare before SSE4.1: both 32-bit halves must match
+				const __m128i c = _mm_cmpeq_epi32(l, r);
+				return _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2,3,0,1)));
+			}
+		}
+		static std::uint32_t laneBits(__m128i v) {
+			if constexpr (sizeof(mask_type) == 4) return _mm_movemask_ps(_mm_castsi128_ps(v));
+			else if constexpr (sizeof(mask_type) == 8) return _mm_movemask_pd(_mm_castsi128_pd(v));
+			else return compressBytes(_mm_movemask_epi8(v));
+		}
+#endif
+#ifdef __AVX2__
+		static __m256i And(__m256i l, __m256i r) { return _mm256_and_si256(l, r); }
+		static __m256i andNot(__m256i n, __m256i v) { return _mm256_andnot_si256(n, v); }
+		static __m256i cmpeq(__m256i l, __m256i r) {
+			if constexpr (sizeof(mask_type) == 1) return _mm256_cmpeq_epi8(l, r);
+			else if constexpr (sizeof(mask_type) == 2) return _mm256_cmpeq_epi16(l, r);
+			else if constexpr (sizeof(mask_type) == 4) return _mm256_cmpeq_epi32(l, r);
+			else return _mm256_cmpeq_epi64(l, r);
+		}
+		static std::uint32_t laneBits(__m256i v) {
+			if constexpr (sizeof(mask_type) == 4) return _mm256_movemask_ps(_mm256_castsi256_ps(v));
+			else if constexpr (sizeof(mask_type) == 8) return _mm256_movemask_pd(_mm256_castsi256_pd(v));
+			else return compressBytes(_mm256_movemask_epi8(v));
+		}
+#endif
 	};
 
 	class Entity
@@ -278,13 +2526,23 @@ namespace bagel
 
 		const Mask& mask() const { return World::mask(_ent); }
 
-		template <class T> T& get() const { return World::getComponent<T>(_ent); }
+		template <class T> decltype(auto) get() const { return World::getComponent<T>(_ent); }
 		template <class T> void add(const T& t) const {
 			return World::addComponent<T>(_ent, t);
 		}
+		template <class T, class = std::enable_if_t<!std::is_reference_v<T>>> void add(T&& t) const {
+			return World::addComponent<T>(_ent, std::move(t));
+		}
+		template <class T, class ...Args> void emplace(Args&&... args) const {
+			return World::emplaceComponent<T>(_ent, std::forward<Args>(args)...);
+		}
 		template <class T> void del() const {
 			return World::delComponent<T>(_ent);
 		}
+		template <class T> decltype(auto) patch() const { return World::patch<T>(_ent); }
+		template <class T, class F> void patch(F&& f) const {
+			World::patch<T>(_ent, std::forward<F>(f));
+		}
 
 		template <class T, class ...Ts> void addAll(const T& t, const Ts&... ts) const {
 			World::addComponents(_ent, t, ts...);
@@ -303,12 +2561,1232 @@ namespace bagel
 	{
 	public:
 		template <class T>
-		MaskBuilder& set() {
+		constexpr MaskBuilder& set() {
 			m.set(Component<T>::Bit);
 			return *this;
 		}
-		Mask build() const { return m; }
+		constexpr Mask build() const { return m; }
 	private:
 		Mask m;
 	};
+
+	/// The mask of Ts, built once; a compile-time constant when all of Ts
+	/// are in ComponentList<>.
+	template <class ...Ts>
+	const Mask& maskOf() {
+		constexpr auto build = [] {
+			MaskBuilder b;
+			(b.set<Ts>(), ...);
+			return b.build();
+		};
+		if constexpr ((IsListed<Ts> && ...)) {
+			static constexpr Mask m = build();
+			return m;
+		}
+		else {
+			static const Mask m = build();
+			return m;
+		}
+	}
+
+	/// Persistent worker threads, one task deque each. A worker pops its own
+	/// deque from the back and steals from the front of the others.
+	/// Params.Threads counts the calling thread as well; 0 picks the
+	/// hardware concurrency, 1 runs every task inside wait().
+	class ThreadPool final : NoInstance
+	{
+	public:
+		struct Task {
+			void (*fn)(void*, index_type);
+			void*		arg;
+			index_type	i;
+		};
+
+		static size_type threads() {
+			static const size_type n = Params.Threads > 0 ? Params.Threads :
+				std::max<size_type>(1, static_cast<size_type>(std::thread::hardware_concurrency()));
+			return n;
+		}
+
+		static void submit(const Task& t) {
+			Workers& w = workers();
+			Queue& q = w.queues[_self >= 0 ? _self : 0];
+			{
+				std::lock_guard<std::mutex> lock(q.m);
+				q.tasks.push_back(t);
+			}
+			++w.queued;
+			std::lock_guard<std::mutex> lock(w.sleepMutex);
+			w.wake.notify_one();
+		}
+
+		/// Runs tasks on the calling thread until pending drops to zero.
+		static void wait(const std::atomic<int>& pending) {
+			Workers& w = workers();
+			const index_type self = _self >= 0 ? _self : 0;
+			Task t;
+			while (pending.load(std::memory_order_acquire) > 0) {
+				if (take(w, self, t))
+					t.fn(t.arg, t.i);
+				else
+					std::this_thread::yield();
+			}
+		}
+	private:
+		struct Queue {
+			std::mutex			m;
+			std::deque<Task>	tasks;
+		};
+		struct Workers {
+			std::unique_ptr<Queue[]>		queues{new Queue[threads()]};
+			std::unique_ptr<std::thread[]>	pool{new std::thread[threads()]};
+			std::atomic<int>				queued{0};
+			std::mutex						sleepMutex;
+			std::condition_variable			wake;
+			bool							stop = false;
+
+			Workers() {
+				for (index_type i = 1; i < threads(); ++i)
+					pool[i] = std::thread(loop, this, i);
+			}
+			~Workers() {
+				{
+					std::lock_guard<std::mutex> lock(sleepMutex);
+					stop = true;
+				}
+				wake.notify_all();
+				for (index_type i = 1; i < threads(); ++i)
+					pool[i].join();
+			}
+		};
+
+		static Workers& workers() {
+			static Workers w;
+			return w;
+		}
+
+		static void loop(Workers* w, index_type self) {
+			_self = self;
+			Task t;
+			for (;;) {
+				if (take(*w, self, t)) {
+					t.fn(t.arg, t.i);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(w->sleepMutex);
+				w->wake.wait(lock, [w] { return w->stop || w->queued.load() > 0; });
+				if (w->stop)
+					return;
+			}
+		}
+
+		static bool take(Workers& w, index_type self, Task& t) {
+			if (w.queued.load() == 0)
+				return false;
+			for (index_type k = 0; k < threads(); ++k) {
+				Queue& q = w.queues[(self+k) % threads()];
+				std::lock_guard<std::mutex> lock(q.m);
+				if (q.tasks.empty())
+					continue;
+				if (k == 0) {
+					t = q.tasks.back();
+					q.tasks.pop_back();
+				} else {
+					t = q.tasks.front();
+					q.tasks.pop_front();
+				}
+				--w.queued;
+				return true;
+			}
+			return false;
+		}
+
+		static inline thread_local index_type _self = -1;
+	};
+
+	/// Records structural changes (create, destroy, add, del) so that they
+	/// can be applied at a sync point instead of under a running iteration.
+	/// Component payloads live in a linear arena. Each worker thread should
+	/// record into its own buffer; flush(buffers, n) merges them in buffer
+	/// order, so the outcome does not depend on thread timing.
+	/// Entities returned by create() are placeholders, valid in this buffer
+	/// until it is flushed.
+	class CommandBuffer : NoCopy
+	{
+	public:
+		ent_type create() {
+			_cmds.push({Kind::Create, -1, {-1 - _creates}, nullptr, nullptr, nullptr, nullptr});
+			return {-1 - _creates++};
+		}
+		void destroy(ent_type e) {
+			_cmds.push({Kind::Destroy, -1, e, nullptr, nullptr, nullptr, nullptr});
+		}
+		template <class T>
+		void add(ent_type e, const T& t) { emplace<T>(e, t); }
+		template <class T, class = std::enable_if_t<!std::is_reference_v<T>>>
+		void add(ent_type e, T&& t) { emplace<T>(e, std::move(t)); }
+		/// builds T in the buffer now and moves it into its storage on flush
+		template <class T, class ...Args>
+		void emplace(ent_type e, Args&&... args) {
+			void* payload = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			_cmds.push({Kind::Add, Component<T>::Index, e, payload,
+				[](ent_type e, void* p) { World::addComponent(e, std::move(*static_cast<T*>(p))); },
+				nullptr,
+				[](void* p) { static_cast<T*>(p)->~T(); }});
+		}
+		template <class T>
+		void del(ent_type e) {
+			_cmds.push({Kind::Del, Component<T>::Index, e, nullptr, nullptr,
+				[](const ent_type* es, size_type n) { World::delComponents<T>(es, n); },
+				nullptr});
+		}
+
+		void flush() {
+			CommandBuffer* self = this;
+			flush(&self, 1);
+		}
+		/// Applies all buffers as one batch: creations first, then adds and
+		/// removals grouped per component (keeping their recorded order),
+		/// then destructions with one compaction pass per storage.
+		static void flush(CommandBuffer* const* buffers, size_type n) {
+			for (index_type b = 0; b < n; ++b) {
+				CommandBuffer& buf = *buffers[b];
+				buf._created.resize(buf._creates);
+				World::createEntities(buf._creates, buf._created.data());
+			}
+
+			_pending.clear();
+			_destroyed.clear();
+			for (index_type b = 0; b < n; ++b) {
+				CommandBuffer& buf = *buffers[b];
+				for (index_type i = 0; i < buf._cmds.size(); ++i) {
+					Command c = buf._cmds[i];
+					if (c.e.id < 0)
+						c.e = buf._created[-1 - c.e.id];
+					if (c.kind == Kind::Destroy)
+						_destroyed.push(c.e);
+					else if (c.kind != Kind::Create)
+						_pending.push(c);
+				}
+			}
+
+			std::stable_sort(_pending.data(), _pending.data() + _pending.size(),
+				[](const Command& l, const Command& r) { return l.comp < r.comp; });
+			for (index_type i = 0; i < _pending.size();) {
+				const Command& c = _pending[i++];
+				if (c.kind == Kind::Add) {
+					c.apply(c.e, c.payload);
+					continue;
+				}
+				// a run of removals of one component becomes a single batch
+				_batch.clear();
+				const Mask::bit_type bit = Mask::bit(c.comp);
+				if (World::mask(c.e).test(bit))
+					_batch.push(c.e);
+				for (; i < _pending.size() && _pending[i].kind == Kind::Del && _pending[i].comp == c.comp; ++i)
+					if (World::mask(_pending[i].e).test(bit))
+						_batch.push(_pending[i].e);
+				c.applyMany(_batch.data(), sortUnique(_batch));
+			}
+
+			World::destroyEntities(_destroyed.data(), sortUnique(_destroyed));
+
+			for (index_type b = 0; b < n; ++b)
+				buffers[b]->clear();
+		}
+
+		/// Drops all recorded commands without applying them.
+		void clear() {
+			for (index_type i = 0; i < _cmds.size(); ++i)
+				if (_cmds[i].drop)
+					_cmds[i].drop(_cmds[i].payload);
+			_cmds.clear();
+			_created.clear();
+			_creates = 0;
+			for (index_type i = 0; i < _large.size(); ++i)
+				alignedFree(_large[i]);
+			_large.clear();
+			_block = 0;
+			_used = 0;
+		}
+
+		~CommandBuffer() {
+			clear();
+			for (index_type i = 0; i < _blocks.size(); ++i)
+				alignedFree(_blocks[i]);
+		}
+	private:
+		enum class Kind { Create, Destroy, Add, Del };
+		struct Command {
+			Kind		kind;
+			index_type	comp;
+			ent_type	e;
+			void*		payload;
+			void (*apply)(ent_type, void*);
+			void (*applyMany)(const ent_type*, size_type);
+			void (*drop)(void*);
+		};
+		static constexpr size_type BlockSize = 16*1024;
+		static constexpr size_type BlockAlignment = 64;
+
+		/// bump allocation in fixed blocks, which never move once handed out
+		void* allocate(size_type size, size_type align) {
+			if (size > BlockSize) {
+				_large.push(alignedAlloc(size, BlockAlignment));
+				return _large[_large.size()-1];
+			}
+			_used = (_used + align-1) / align * align;
+			if (_block < _blocks.size() && _used + size > BlockSize) {
+				++_block;
+				_used = 0;
+			}
+			if (_block == _blocks.size())
+				_blocks.push(static_cast<unsigned char*>(alignedAlloc(BlockSize, BlockAlignment)));
+			void* p = _blocks[_block] + _used;
+			_used += size;
+			return p;
+		}
+
+		/// sorts ids and drops repeats, so each entity is handled once
+		template <class B>
+		static size_type sortUnique(B& ids) {
+			std::sort(ids.data(), ids.data() + ids.size(),
+				[](ent_type l, ent_type r) { return l.id < r.id; });
+			return std::unique(ids.data(), ids.data() + ids.size(),
+				[](ent_type l, ent_type r) { return l.id == r.id; }) - ids.data();
+		}
+
+		DynamicBag<Command,64>			_cmds;
+		DynamicBag<ent_type,16>			_created;
+		DynamicBag<unsigned char*,4>	_blocks;
+		DynamicBag<void*,4>				_large;
+		size_type						_creates = 0;
+		index_type						_block = 0;
+		size_type						_used = 0;
+
+		static inline thread_local DynamicBag<Command,64>	_pending;
+		static inline thread_local DynamicBag<ent_type,64>	_destroyed;
+		static inline thread_local DynamicBag<ent_type,64>	_batch;
+	};
+
+	/// Owning group: after World::group<Ts...>(), every entity holding all
+	/// of Ts sits in the first size() slots of each Ts storage, in the same
+	/// order in all of them. World keeps this up with O(1) swaps when such
+	/// a component is added or removed, and View<Ts...> then walks the
+	/// storages in lockstep without index lookups.
+	/// A storage belongs to one group at most.
+	template <class ...Ts>
+	class Group final : NoInstance
+	{
+		static_assert(sizeof...(Ts) > 1, "A group needs at least two components");
+		static_assert((IsPacked<typename Storage<Ts>::type>::value && ...), "Groups own packed storages only");
+		using First = typename Storage<std::tuple_element_t<0, std::tuple<Ts...>>>::type;
+	public:
+		/// Makes the current registry keep the group. Returns false when
+		/// one of Ts already belongs to another group.
+		static bool own() {
+			auto& w = World::data();
+			if (owned())
+				return true;
+			if (((w.enter[Component<Ts>::Index] != nullptr) || ...))
+				return false;
+			((w.enter[Component<Ts>::Index] = &enter), ...);
+			((w.leave[Component<Ts>::Index] = &leave), ...);
+			for (index_type i = 0; i < First::size(); ++i)
+				enter(First::entity(i));
+			return true;
+		}
+		static bool owned() { return World::data().enter[Component<std::tuple_element_t<0, std::tuple<Ts...>>>::Index] == &enter; }
+		static size_type size() { return First::data().grouped; }
+
+		/// PackedStorage::sort() for the group prefix, whose swaps move all
+		/// of Ts in lockstep
+		template <class Compare = IdOrder>
+		static bool sort(Compare cmp = {}, std::chrono::microseconds budget = std::chrono::microseconds::max()) {
+			auto& lead = First::data();
+			return insertionSort(0, lead.grouped, lead.groupSorted,
+				[&](index_type i, index_type j) { return cmp(First::entity(lead, i), First::entity(lead, j)); },
+				[](index_type i, index_type j) { (Storage<Ts>::type::swap(Storage<Ts>::type::data(), i, j), ...); },
+				budget);
+		}
+	private:
+		static const Mask& mask() { return maskOf<Ts...>(); }
+
+		static bool grouped(ent_type e) {
+			auto& d = First::data();
+			return World::mask(e).test(mask()) && First::index(d, e) < d.grouped;
+		}
+		static void enter(ent_type e) {
+			if (World::mask(e).test(mask()) && !grouped(e))
+				(swapIn<Ts>(e), ...);
+		}
+		static void leave(ent_type e) {
+			if (!grouped(e))
+				return;
+			auto& lead = First::data();
+			lead.groupSorted = std::min(lead.groupSorted, First::index(lead, e));
+			(swapOut<Ts>(e), ...);
+		}
+		template <class T>
+		static void swapIn(ent_type e) {
+			using S = typename Storage<T>::type;
+			auto& d = S::data();
+			const index_type idx = S::index(d, e);
+			S::swap(d, idx, d.grouped++);
+			d.sorted = std::min(d.sorted, idx);
+		}
+		template <class T>
+		static void swapOut(ent_type e) {
+			using S = typename Storage<T>::type;
+			auto& d = S::data();
+			S::swap(d, S::index(d, e), --d.grouped);
+			d.sorted = std::min(d.sorted, d.grouped);
+		}
+	};
+
+	/// Iterates all entities holding every component in Ts.
+	/// The smallest PackedStorage or TaggedStorage among Ts drives the
+	/// iteration, so the cost follows the number of candidates rather than
+	/// World::maxId(), and the masks settle the intersection before any
+	/// component is read. When
+	/// some of Ts are archetype-stored and the matching archetypes hold fewer
+	/// rows, their chunks are streamed instead. Without either, the
+	/// Presence columns of Ts are intersected.
+	/// The callback receives (ent_type, Ts&...), or SoARef<T> for SoA
+	/// components, leaving out tags, and may remove packed components from
+	/// the entity it was handed.
+	template <class ...Ts>
+	class View final
+	{
+	public:
+		static const Mask& mask() { return maskOf<Ts...>(); }
+		static const Mask& archetypeMask() {
+			static const Mask m = [] {
+				MaskBuilder b;
+				((IsArchetype<typename Storage<Ts>::type>::value ? b.set<Ts>() : b), ...);
+				return b.build();
+			}();
+			return m;
+		}
+
+		template <class F>
+		static void each(F&& f) {
+			each(f, std::index_sequence_for<Ts...>{});
+		}
+
+		/// Splits the driving PackedStorage into chunks of grain slots that
+		/// the ThreadPool threads claim, on the caller's registry, until none
+		/// are left. f runs
+		/// concurrently on different entities and must not make structural
+		/// changes. Without a packed driver this falls back to each().
+		template <class F>
+		static void parallelEach(F&& f, size_type grain) {
+			parallelEach(f, std::max<size_type>(1, grain), std::index_sequence_for<Ts...>{});
+		}
+
+		/// each() driven by the first component, skipping the slots whose
+		/// tick is not past `since`: an unchanged entity costs one compare.
+		template <class F>
+		static void eachChanged(tick_type since, F&& f) {
+			using S = typename Storage<Nth<0>>::type;
+			static_assert(IsTicked<S>::value, "eachChanged filters storages that keep ticks");
+			const auto& d = S::data();
+			drive<Nth<0>>(f, [&](index_type i) { return S::changedSince(d, i, since); },
+				std::index_sequence_for<Ts...>{});
+		}
+	private:
+		static constexpr size_type NotPacked = ~0u>>1;
+		static constexpr bool AnyArchetype = (IsArchetype<typename Storage<Ts>::type>::value || ...);
+		static constexpr bool AllArchetype = (IsArchetype<typename Storage<Ts>::type>::value && ...);
+		static constexpr bool Groupable = sizeof...(Ts) > 1 && (IsPacked<typename Storage<Ts>::type>::value && ...);
+		using Lead = typename Storage<std::tuple_element_t<0, std::tuple<Ts...>>>::type;
+
+		template <std::size_t I>
+		using Nth = std::tuple_element_t<I, std::tuple<Ts...>>;
+		template <std::size_t I>
+		using ArgOf = std::conditional_t<IsTag<typename Storage<Nth<I>>::type>::value,
+			std::index_sequence<>, std::index_sequence<I>>;
+		template <class ...Seqs> struct Cat { using type = std::index_sequence<>; };
+		template <std::size_t ...As>
+		struct Cat<std::index_sequence<As...>> { using type = std::index_sequence<As...>; };
+		template <std::size_t ...As, std::size_t ...Bs, class ...Rest>
+		struct Cat<std::index_sequence<As...>, std::index_sequence<Bs...>, Rest...> :
+			Cat<std::index_sequence<As..., Bs...>, Rest...> {};
+		template <std::size_t ...Is>
+		static typename Cat<ArgOf<Is>...>::type args(std::index_sequence<Is...>);
+		/// positions in Ts of the callback arguments: all but the tags
+		using Args = decltype(args(std::index_sequence_for<Ts...>{}));
+
+		/// f(e, get(A)...) for the positions A in Args
+		template <class F, class G, std::size_t ...As>
+		static void call(F& f, ent_type e, G&& get, std::index_sequence<As...>) {
+			f(e, get(std::integral_constant<std::size_t, As>{})...);
+		}
+
+		template <class T>
+		static size_type drivingSize() {
+			if constexpr (IsDense<typename Storage<T>::type>::value)
+				return Storage<T>::type::size();
+			else
+				return NotPacked;
+		}
+
+		/// keeps every slot of the driving storage
+		struct AllSlots {
+			bool operator()(index_type) const { return true; }
+		};
+
+		static std::size_t driver(const size_type* sizes) {
+			std::size_t best = 0;
+			for (std::size_t i = 1; i < sizeof...(Ts); ++i)
+				if (sizes[i] < sizes[best])
+					best = i;
+			return best;
+		}
+
+		template <class F, std::size_t ...Is>
+		static void each(F& f, std::index_sequence<Is...> is) {
+			if constexpr (Groupable)
+				if (Group<Ts...>::owned()) {
+					driveGroup(f, is);
+					return;
+				}
+			const size_type sizes[] = {drivingSize<Ts>()...};
+			const std::size_t best = driver(sizes);
+
+			if constexpr (AnyArchetype) {
+				const Mask& am = archetypeMask();
+				size_type rows = 0;
+				for (index_type a = 0; a < Archetypes::count(); ++a)
+					if (Archetypes::get(a).mask.test(am))
+						rows += Archetypes::get(a).size;
+				if (rows <= sizes[best]) {
+					streamArchetypes(f);
+					return;
+				}
+			}
+
+			if (sizes[best] == NotPacked) {
+				const index_type comps[] = {Component<Ts>::Index...};
+				Presence::each(comps, sizeof...(Ts), [&](ent_type e) {
+					call(f, e, [e](auto a) -> decltype(auto) { return World::getComponent<Nth<a>>(e); }, Args{});
+				});
+			}
+			else
+				((best == Is ? drive<Ts>(f, AllSlots{}, std::index_sequence<Is...>{}) : void()), ...);
+		}
+
+		template <class S, class = void> struct HasData : std::false_type {};
+		template <class S> struct HasData<S, std::void_t<decltype(S::data())>> : std::true_type {};
+
+		/// the storage state of T, looked up once per iteration
+		template <class T>
+		static auto* state() {
+			using S = typename Storage<T>::type;
+			if constexpr (HasData<S>::value)
+				return &S::data();
+			else
+				return static_cast<void*>(nullptr);
+		}
+		/// T's cursor, read at the top of every step
+		template <class T, class D>
+		static auto cursor(D* d) {
+			if constexpr (HasData<typename Storage<T>::type>::value)
+				return Storage<T>::type::cursor(*d);
+			else
+				return d;
+		}
+		/// T of entity e, found in slot i of the driving storage D
+		template <class D, class T, class C>
+		static decltype(auto) fetch(const C& c, ent_type e, index_type i) {
+			using S = typename Storage<T>::type;
+			if constexpr (std::is_same_v<D, T>)
+				return S::get(c, i);
+			else if constexpr (HasData<S>::value)
+				return S::get(c, e);
+			else
+				return World::getComponent<T>(e);
+		}
+
+		template <class T, class F, class Keep, std::size_t ...Is>
+		static void drive(F& f, Keep keep, std::index_sequence<Is...>) {
+			using S = typename Storage<T>::type;
+			if constexpr (IsDense<S>::value) {
+				const Mask& m = mask();
+				auto& d = S::data();
+				const auto& w = World::data();
+				const std::tuple states{state<Ts>()...};
+				// backwards, so that a swap-removal of the current entity
+				// only moves an already visited one into its slot
+				for (index_type i = S::size()-1; i >= 0; --i) {
+					const std::tuple cursors{cursor<Ts>(std::get<Is>(states))...};
+					const Mask* masks = World::masks(w);
+					const ent_type e = S::entity(d, i);
+					// skip slots that removals inside f cut off the end
+					if (i < S::size(d) && keep(i) && masks[e.id].test(m))
+						call(f, e, [&](auto a) -> decltype(auto) {
+							return fetch<T, Nth<a>>(std::get<a>(cursors), e, i);
+						}, Args{});
+				}
+			}
+		}
+
+		/// walks the group prefix, where slot i holds the same entity in
+		/// every storage
+		template <class F, std::size_t ...Is>
+		static void driveGroup(F& f, std::index_sequence<Is...>) {
+			const std::tuple states{state<Ts>()...};
+			const auto& lead = *std::get<0>(states);
+			// backwards, so that an entity leaving the group only moves an
+			// already visited one into its slot
+			for (index_type i = lead.grouped-1; i >= 0; --i) {
+				if (i >= lead.grouped)
+					continue;
+				const std::tuple cursors{cursor<Ts>(std::get<Is>(states))...};
+				f(Lead::entity(lead, i), Storage<Ts>::type::get(std::get<Is>(cursors), i)...);
+			}
+		}
+
+		template <class F, std::size_t ...Is>
+		static void parallelEach(F& f, size_type grain, std::index_sequence<Is...> is) {
+			if constexpr (Groupable)
+				if (Group<Ts...>::owned()) {
+					runJob(f, Group<Ts...>::size(), grain, runGroupChunks<F,Is...>);
+					return;
+				}
+			const size_type sizes[] = {drivingSize<Ts>()...};
+			const std::size_t best = driver(sizes);
+			if (sizes[best] == NotPacked)
+				each(f, is);
+			else
+				((best == Is ? driveParallel<Ts>(f, grain, is) : void()), ...);
+		}
+
+		template <class F>
+		struct Job {
+			F&					f;
+			Registry&			registry;
+			size_type			size;
+			size_type			grain;
+			std::atomic<int>	next{0};
+			std::atomic<int>	pending{0};
+		};
+
+		template <class T, class F, std::size_t ...Is>
+		static void driveParallel(F& f, size_type grain, std::index_sequence<Is...>) {
+			if constexpr (IsDense<typename Storage<T>::type>::value)
+				runJob(f, Storage<T>::type::size(), grain, runChunks<T,F,Is...>);
+		}
+
+		template <class F>
+		static void runJob(F& f, size_type size, size_type grain, void (*run)(void*, index_type)) {
+			Job<F> job{f, Registry::current(), size, grain};
+			const size_type tasks = std::min(ThreadPool::threads(), (job.size + grain-1) / grain);
+			job.pending.store(tasks, std::memory_order_relaxed);
+			for (index_type t = 1; t < tasks; ++t)
+				ThreadPool::submit({run, &job, t});
+			if (tasks > 0)
+				run(&job, 0);
+			ThreadPool::wait(job.pending);
+		}
+
+		/// claims chunks off the shared cursor until the storage is covered
+		template <class T, class F, std::size_t ...Is>
+		static void runChunks(void* p, index_type) {
+			using S = typename Storage<T>::type;
+			Job<F>& job = *static_cast<Job<F>*>(p);
+			const Registry::Scope scope(job.registry);
+			const Mask& m = mask();
+			auto& d = S::data();
+			const auto& w = World::data();
+			const std::tuple states{state<Ts>()...};
+			for (;;) {
+				const index_type first = job.next.fetch_add(job.grain, std::memory_order_relaxed);
+				if (first >= job.size)
+					break;
+				const index_type last = std::min(first + job.grain, job.size);
+				for (index_type i = first; i < last; ++i) {
+					const std::tuple cursors{cursor<Ts>(std::get<Is>(states))...};
+					const Mask* masks = World::masks(w);
+					const ent_type e = S::entity(d, i);
+					if (masks[e.id].test(m))
+						call(job.f, e, [&](auto a) -> decltype(auto) {
+							return fetch<T, Nth<a>>(std::get<a>(cursors), e, i);
+						}, Args{});
+				}
+			}
+			job.pending.fetch_sub(1, std::memory_order_acq_rel);
+		}
+
+		template <class F, std::size_t ...Is>
+		static void runGroupChunks(void* p, index_type) {
+			Job<F>& job = *static_cast<Job<F>*>(p);
+			const Registry::Scope scope(job.registry);
+			const std::tuple states{state<Ts>()...};
+			const auto& lead = *std::get<0>(states);
+			for (;;) {
+				const index_type first = job.next.fetch_add(job.grain, std::memory_order_relaxed);
+				if (first >= job.size)
+					break;
+				const index_type last = std::min(first + job.grain, job.size);
+				for (index_type i = first; i < last; ++i) {
+					const std::tuple cursors{cursor<Ts>(std::get<Is>(states))...};
+					job.f(Lead::entity(lead, i), Storage<Ts>::type::get(std::get<Is>(cursors), i)...);
+				}
+			}
+			job.pending.fetch_sub(1, std::memory_order_acq_rel);
+		}
+
+		template <class F>
+		static void streamArchetypes(F& f) {
+			const Mask& m = mask();
+			const Mask& am = archetypeMask();
+			for (index_type a = 0; a < Archetypes::count(); ++a) {
+				const Archetypes::Archetype& arch = Archetypes::get(a);
+				if (!arch.mask.test(am))
+					continue;
+				for (index_type first = 0; first < arch.size; first += arch.rowsPerChunk) {
+					unsigned char* chunk = arch.chunks[first / arch.rowsPerChunk];
+					const ent_type* ents = arch.entities(chunk);
+					const size_type rows = std::min(arch.rowsPerChunk, arch.size-first);
+					for (index_type r = 0; r < rows; ++r)
+						if (AllArchetype || World::mask(ents[r]).test(m))
+							call(f, ents[r], [&](auto a) -> decltype(auto) {
+								return column<Nth<a>>(arch, chunk, r, ents[r]);
+							}, Args{});
+				}
+			}
+		}
+
+		template <class T>
+		static decltype(auto) column(const Archetypes::Archetype& a, unsigned char* chunk, index_type r, ent_type e) {
+			if constexpr (IsArchetype<typename Storage<T>::type>::value)
+				return a.column<T>(chunk)[r];
+			else
+				return World::getComponent<T>(e);
+		}
+	};
+
+	template <class T, class ...Ts, class F>
+	void World::each(F&& f) {
+		View<T,Ts...>::each(f);
+	}
+
+	template <class T, class ...Ts, class F>
+	void World::parallelEach(F&& f, size_type grain) {
+		View<T,Ts...>::parallelEach(f, grain);
+	}
+
+	template <class T, class ...Ts, class F>
+	void World::eachChanged(tick_type since, F&& f) {
+		View<T,Ts...>::eachChanged(since, f);
+	}
+
+	template <class ...Ts>
+	bool World::group() {
+		return Group<Ts...>::own();
+	}
+
+	template <class T>
+	void HierarchyStorage<T>::destroySubtree(ent_type e) {
+		Data& d = data();
+		const index_type i = d.entToComp[e.id];
+		DynamicBag<ent_type,16> subtree;
+		subtree.push(d.compToEnt.data()+i, d.sizes[i]);
+		World::destroyEntities(subtree.data(), subtree.size());
+	}
+
+	/// Orders entities as they sit in Other's packed storage, those without
+	/// Other after them by id.
+	template <class T>
+	struct StorageOrder {
+		static_assert(IsPacked<typename Storage<T>::type>::value, "sortAs follows packed storages only");
+
+		bool operator()(ent_type a, ent_type b) const { return rank(a) < rank(b); }
+	private:
+		using S = typename Storage<T>::type;
+		const std::remove_reference_t<decltype(S::data())>& d = S::data();
+		const std::int64_t size = S::size();
+
+		std::int64_t rank(ent_type e) const {
+			return World::mask(e).test(Component<T>::Bit) ? S::index(d, e) : size + e.id;
+		}
+	};
+
+	template <class List>
+	bool World::saveSnapshot(const char* path) {
+		static_assert(Snapshot::Listed<List>, "snapshots name components by their ComponentList index");
+		return saveSnapshot(path, Snapshot::Saved<List>{});
+	}
+	template <class List>
+	bool World::loadSnapshot(const char* path) {
+		static_assert(Snapshot::Listed<List>, "snapshots name components by their ComponentList index");
+		return loadSnapshot(path, Snapshot::Saved<List>{});
+	}
+
+	template <class ...Ts>
+	bool World::saveSnapshot(const char* path, Components<Ts...>) {
+		Data& d = data();
+		if (!Snapshot::covers(Components<Ts...>{}))
+			return false;
+
+		constexpr std::uint32_t saving = sizeof...(Ts);
+		struct Front {
+			Snapshot::Header	header;
+			Snapshot::Record	records[saving > 0 ? saving : 1];
+		} front{};
+		const std::size_t frontBytes = sizeof(Snapshot::Header) + saving*sizeof(Snapshot::Record);
+		Snapshot::Writer w(path, frontBytes);
+		if (!w.ok())
+			return false;
+
+		Snapshot::Header& h = front.header;
+		memcpy(h.magic, Snapshot::Magic, sizeof(h.magic));
+		h.version = Snapshot::Version;
+		h.maxComponents = Params.MaxComponents;
+		h.pageSize = Params.PageSize;
+		h.maskBytes = sizeof(Mask);
+		h.maxId = d.maxId.id;
+		h.records = saving;
+		h.masks = w.write(d.masks.data(), d.masks.size()*sizeof(Mask));
+		h.ids = w.write(d.ids.data(), d.ids.size()*sizeof(ent_type));
+		Snapshot::Record* r = front.records;
+		(saveRecord<Ts>(w, *r++), ...);
+		return w.finish(&front, frontBytes);
+	}
+
+	template <class T>
+	void World::saveRecord(Snapshot::Writer& w, Snapshot::Record& r) {
+		using S = typename Storage<T>::type;
+		auto& d = S::data();
+		r.comp = Component<T>::Index;
+		r.kind = Snapshot::kindOf<T>();
+		r.bytes = sizeof(T);
+		r.align = alignof(T);
+		r.type = Snapshot::fingerprint<T>();
+		const auto savePages = [&](const auto& bag, Snapshot::Section& pages, Snapshot::Section& values) {
+			pages = w.begin();
+			bag.eachPage([&](index_type p, const auto*) {
+				const std::uint32_t n = p;
+				w.append(pages, &n, sizeof(n));
+			});
+			values = w.begin();
+			bag.eachPage([&](index_type, const auto* page) {
+				w.append(values, page, sizeof(*page)*Params.PageSize);
+			});
+			return static_cast<std::uint32_t>(pages.bytes / sizeof(std::uint32_t));
+		};
+		if constexpr (Snapshot::kindOf<T>() == Snapshot::SoA) {
+			r.count = d.size;
+			r.values = w.begin();
+			S::eachColumn([&](std::size_t, const auto* col) { w.append(r.values, col, sizeof(*col)*d.size); });
+			r.entities = w.write(d.compToEnt.data(), d.compToEnt.size()*sizeof(ent_type));
+			savePages(d.entToComp, r.pages, r.index);
+		}
+		else if constexpr (Snapshot::kindOf<T>() == Snapshot::Packed) {
+			r.count = d.comps.size();
+			r.values = w.write(d.comps.data(), d.comps.size()*sizeof(T));
+			r.entities = w.write(d.compToEnt.data(), d.compToEnt.size()*sizeof(ent_type));
+			savePages(d.entToComp, r.pages, r.index);
+		}
+		else
+			r.count = savePages(d.bag, r.pages, r.values);
+		const Presence::Column col = Presence::column(Component<T>::Index);
+		r.presence = w.write(col.words, col.size*sizeof(std::uint64_t));
+		r.summary = w.write(col.summary, col.blocks*sizeof(std::uint64_t));
+	}
+
+	template <class ...Ts>
+	bool World::loadSnapshot(const char* path, Components<Ts...>) {
+		Data& d = data();
+		if (d.maxId.id >= 0)
+			return false;
+		const Snapshot::Mapping m(path);
+		const auto* h = static_cast<const Snapshot::Header*>(m.at({0, sizeof(Snapshot::Header)}));
+		if (!h || memcmp(h->magic, Snapshot::Magic, sizeof(h->magic)) != 0 || h->version != Snapshot::Version ||
+				h->maxComponents != Params.MaxComponents || h->pageSize != Params.PageSize ||
+				h->maskBytes != sizeof(Mask) || h->maxId < -1)
+			return false;
+		const auto* rs = static_cast<const Snapshot::Record*>(
+			m.at({sizeof(Snapshot::Header), std::uint64_t{h->records}*sizeof(Snapshot::Record)}));
+		const size_type entities = h->maxId+1;
+		if (!rs || h->records != sizeof...(Ts) || !m.at(h->masks) || !m.at(h->ids) ||
+				h->masks.bytes != entities*sizeof(Mask) || h->ids.bytes % sizeof(ent_type) != 0)
+			return false;
+		if (!(checkRecord<Ts>(m, rs, h->records) && ...))
+			return false;
+
+		d.masks.push(static_cast<const Mask*>(m.at(h->masks)), entities);
+		d.ids.push(static_cast<const ent_type*>(m.at(h->ids)), h->ids.bytes/sizeof(ent_type));
+		d.maxId = {h->maxId};
+		(loadRecord<Ts>(m, rs, h->records), ...);
+		return true;
+	}
+
+	template <class T>
+	bool World::checkRecord(const Snapshot::Mapping& m, const Snapshot::Record* rs, std::uint32_t n) {
+		using S = typename Storage<T>::type;
+		for (const Snapshot::Record* r = rs; r != rs+n; ++r) {
+			if (r->comp != std::uint32_t(Component<T>::Index))
+				continue;
+			constexpr bool sparse = Snapshot::kindOf<T>() == Snapshot::Sparse;
+			std::size_t row = sizeof(T);
+			if constexpr (Snapshot::kindOf<T>() == Snapshot::SoA)
+				row = S::RowBytes;
+			const std::uint64_t pages = r->pages.bytes / sizeof(std::uint32_t);
+			const std::uint64_t page = std::uint64_t{Params.PageSize} * (sparse ? sizeof(T) : sizeof(index_type));
+			bool ok = r->bytes == sizeof(T) && r->align == alignof(T) && r->type == Snapshot::fingerprint<T>() &&
+				r->kind == Snapshot::kindOf<T>() &&
+				m.at(r->values) && m.at(r->pages) && m.at(r->presence) && m.at(r->summary) &&
+				(sparse ? r->values.bytes == pages*page && pages == r->count
+				: m.at(r->index) && m.at(r->entities) && r->index.bytes == pages*page &&
+					r->values.bytes == std::uint64_t{r->count}*row &&
+					r->entities.bytes == std::uint64_t{r->count}*sizeof(ent_type));
+			const auto* numbers = static_cast<const std::uint32_t*>(m.at(r->pages));
+			for (std::uint64_t p = 0; ok && p < pages; ++p)
+				ok = std::uint64_t{numbers[p]}*Params.PageSize <= 0x7fffffff && (p == 0 || numbers[p] > numbers[p-1]);
+			return ok;
+		}
+		return false;
+	}
+
+	template <class T>
+	void World::loadRecord(const Snapshot::Mapping& m, const Snapshot::Record* rs, std::uint32_t n) {
+		using S = typename Storage<T>::type;
+		auto& d = S::data();
+		const Snapshot::Record& r = *std::find_if(rs, rs+n,
+			[](const Snapshot::Record& r) { return r.comp == std::uint32_t(Component<T>::Index); });
+		const auto loadPages = [&](auto& bag, const Snapshot::Section& values) {
+			const auto* numbers = static_cast<const std::uint32_t*>(m.at(r.pages));
+			const auto* src = static_cast<const unsigned char*>(m.at(values));
+			const std::size_t page = sizeof(*bag.pages()[0]) * Params.PageSize;
+			for (std::uint64_t p = 0; p < r.pages.bytes/sizeof(std::uint32_t); ++p)
+				memcpy(static_cast<void*>(bag.claimPage(numbers[p])), src + p*page, page);
+		};
+		if constexpr (Snapshot::kindOf<T>() == Snapshot::SoA) {
+			S::reserve(r.count);
+			const auto* src = static_cast<const unsigned char*>(m.at(r.values));
+			S::eachColumn([&](std::size_t, auto* col) {
+				memcpy(col, src, sizeof(*col)*r.count);
+				src += sizeof(*col)*r.count;
+			});
+			d.size = r.count;
+			d.compToEnt.push(static_cast<const ent_type*>(m.at(r.entities)), r.count);
+			loadPages(d.entToComp, r.index);
+		}
+		else if constexpr (Snapshot::kindOf<T>() == Snapshot::Packed) {
+			d.comps.push(static_cast<const T*>(m.at(r.values)), r.count);
+			d.compToEnt.push(static_cast<const ent_type*>(m.at(r.entities)), r.count);
+			d.ticks.ensure(r.count);
+			for (index_type i = 0; i < index_type(r.count); ++i)
+				d.ticks.push(Registry::current().tick());
+			loadPages(d.entToComp, r.index);
+		}
+		else
+			loadPages(d.bag, r.values);
+		Presence::assign(Component<T>::Index, {static_cast<const std::uint64_t*>(m.at(r.presence)),
+			size_type(r.presence.bytes/sizeof(std::uint64_t)), static_cast<const std::uint64_t*>(m.at(r.summary)),
+			size_type(r.summary.bytes/sizeof(std::uint64_t))});
+		data().removers[Component<T>::Index] = &remover<T>;
+	}
+
+	/// The last few states of the current registry, for rollback and undo.
+	/// capture() stores the entities and the components of List that
+	/// snapshots can store, cut into 4 KiB chunks: a chunk equal to the
+	/// same chunk of the newest frame is shared with it, so each frame costs
+	/// about the memory its changes touched. restore() rewinds the registry
+	/// by copying back only the chunks where the frame differs from the
+	/// live state, so writes made since the last capture are undone too.
+	/// get() hands out plain references, so no write path records dirty
+	/// pages: both calls read the whole state, and only the copies scale
+	/// with what changed.
+	/// Observers hear nothing of a restore.
+	template <class List = ComponentList<>>
+	class StateHistory : NoCopy
+	{
+		using Saved = Snapshot::Saved<List>;
+	public:
+		static constexpr std::size_t ChunkBytes = 4096;
+
+		explicit StateHistory(size_type frames) : _capacity(frames) {
+			if (frames < 1)
+				throw std::invalid_argument("StateHistory keeps at least one frame");
+			_frames.reset(new Frame[frames]);
+		}
+		~StateHistory() {
+			for (index_type i = 0; i < _count; ++i)
+				release(frame(i));
+		}
+
+		/// frames held, newest at back 0
+		size_type size() const { return _count; }
+		/// chunks held across all frames
+		size_type chunks() const { return _chunks; }
+
+		/// Stores the current state as the newest frame, dropping the oldest
+		/// one when full. Fails when an entity holds a component it cannot
+		/// store, see World::saveSnapshot().
+		bool capture() {
+			if (!Snapshot::covers(Saved{}))
+				return false;
+			if (_count == _capacity) {
+				release(frame(_count-1));
+				_first = (_first+1) % _capacity;
+				--_count;
+			}
+			Frame& f = _frames[(_first+_count) % _capacity];
+			const Frame* prev = _count > 0 ? &frame(0) : nullptr;
+			++_count;
+			visit(Saved{}, [&](std::uint64_t key, auto* data, size_type n, auto&&) {
+				store(f, prev, key, data, n*sizeof(*data));
+			});
+			std::sort(f.arrays.data(), f.arrays.data()+f.arrays.size(),
+				[](const Array& a, const Array& b) { return a.key < b.key; });
+			return true;
+		}
+
+		/// Puts the registry back into the frame `back` captures ago and
+		/// drops the newer frames, so it becomes the newest.
+		void restore(size_type back) {
+			if (back < 0 || back >= _count)
+				throw std::out_of_range("StateHistory holds no such frame");
+			const Frame& to = frame(back);
+			visit(Saved{}, [&](std::uint64_t key, auto*, size_type, auto&& resize) {
+				const Array* a = find(to, key);
+				if (!a)
+					return;
+				using T = std::remove_pointer_t<decltype(resize(0))>;
+				auto* dst = reinterpret_cast<unsigned char*>(resize(size_type(a->bytes / sizeof(T))));
+				// reading a chunk is cheaper than dirtying it
+				for (index_type c = 0; c < chunksOf(a->bytes); ++c) {
+					const Block* block = to.blocks[a->first+c];
+					const std::size_t n = chunkBytes(*a, c);
+					if (memcmp(dst + c*ChunkBytes, block->bytes, n) != 0)
+						memcpy(dst + c*ChunkBytes, block->bytes, n);
+				}
+			});
+			for (; back > 0; --back, --_count)
+				release(frame(0));
+		}
+	private:
+		struct Block {
+			size_type		refs;
+			unsigned char	bytes[ChunkBytes];
+		};
+		/// one stored array, its chunks are blocks[first, first+chunksOf(bytes))
+		struct Array {
+			std::uint64_t	key;
+			std::size_t		bytes;
+			index_type		first;
+		};
+		struct Frame {
+			DynamicBag<Array,16>	arrays;
+			DynamicBag<Block*,64>	blocks;
+		};
+
+		/// the frame `back` captures ago
+		Frame& frame(size_type back) const { return _frames[(_first+_count-1-back) % _capacity]; }
+
+		static index_type chunksOf(std::size_t bytes) { return index_type((bytes + ChunkBytes-1) / ChunkBytes); }
+		static std::size_t chunkBytes(const Array& a, index_type c) {
+			return std::min(ChunkBytes, a.bytes - c*ChunkBytes);
+		}
+		static const Array* find(const Frame& f, std::uint64_t key) {
+			const Array* end = f.arrays.data()+f.arrays.size();
+			const Array* a = std::lower_bound(f.arrays.data(), end, key,
+				[](const Array& x, std::uint64_t k) { return x.key < k; });
+			return a != end && a->key == key ? a : nullptr;
+		}
+
+		void store(Frame& f, const Frame* prev, std::uint64_t key, const void* data, std::size_t bytes) {
+			const Array a{key, bytes, f.blocks.size()};
+			const Array* old = prev ? find(*prev, key) : nullptr;
+			const auto* src = static_cast<const unsigned char*>(data);
+			for (index_type c = 0; c < chunksOf(bytes); ++c) {
+				const std::size_t n = chunkBytes(a, c);
+				Block* shared = old && c < chunksOf(old->bytes) && chunkBytes(*old, c) == n ?
+					prev->blocks[old->first+c] : nullptr;
+				if (shared && memcmp(shared->bytes, src + c*ChunkBytes, n) == 0)
+					++shared->refs;
+				else {
+					shared = new Block;
+					shared->refs = 1;
+					memcpy(shared->bytes, src + c*ChunkBytes, n);
+					++_chunks;
+				}
+				f.blocks.push(shared);
+			}
+			f.arrays.push(a);
+		}
+		void release(Frame& f) {
+			for (index_type i = 0; i < f.blocks.size(); ++i)
+				if (--f.blocks[i]->refs == 0) {
+					delete f.blocks[i];
+					--_chunks;
+				}
+			f.blocks.clear();
+			f.arrays.clear();
+		}
+
+		/// keys order arrays by component, then by part and page
+		static std::uint64_t key(index_type comp, std::uint64_t part, std::uint64_t page = 0) {
+			return std::uint64_t(comp+1) << 40 | part << 32 | page;
+		}
+		/// Calls f(key, data, n, resize) for every array of the state, where
+		/// resize(n) sizes the live array for n elements and returns it.
+		template <class ...Ts, class F>
+		static void visit(Components<Ts...>, F&& f) {
+			auto& w = World::data();
+			f(key(-1, 0), w.masks.data(), w.masks.size(), [&](size_type n) { w.masks.resize(n); return w.masks.data(); });
+			f(key(-1, 1), w.ids.data(), w.ids.size(), [&](size_type n) { w.ids.resize(n); return w.ids.data(); });
+			f(key(-1, 2), &w.maxId, 1, [&](size_type) { return &w.maxId; });
+			(visit<Ts>(f), ...);
+		}
+		template <class T, class F>
+		static void visit(F& f) {
+			using S = typename Storage<T>::type;
+			auto& d = S::data();
+			const index_type c = Component<T>::Index;
+			const auto pages = [&](auto& bag, std::uint64_t part) {
+				bag.eachPage([&](index_type p, const auto* page) {
+					f(key(c, part, p), page, Params.PageSize, [&bag, p](size_type) { return bag.claimPage(p); });
+				});
+			};
+			if constexpr (Snapshot::kindOf<T>() == Snapshot::SoA) {
+				S::eachColumn([&](auto i, auto* col) {
+					f(key(c, 16+i), col, d.size, [&d](size_type n) {
+						S::reserve(n);
+						d.size = n;
+						return S::template column<decltype(i)::value>();
+					});
+				});
+				f(key(c, 1), d.compToEnt.data(), d.compToEnt.size(), [&](size_type n) { d.compToEnt.resize(n); return d.compToEnt.data(); });
+				f(key(c, 4), &d.sorted, 1, [&](size_type) { return &d.sorted; });
+				f(key(c, 3), &d.grouped, 1, [&](size_type) { return &d.grouped; });
+				f(key(c, 5), &d.groupSorted, 1, [&](size_type) { return &d.groupSorted; });
+				pages(d.entToComp, 8);
+			}
+			else if constexpr (IsPacked<S>::value) {
+				f(key(c, 0), d.comps.data(), d.comps.size(), [&](size_type n) { d.comps.resize(n); return d.comps.data(); });
+				f(key(c, 1), d.compToEnt.data(), d.compToEnt.size(), [&](size_type n) { d.compToEnt.resize(n); return d.compToEnt.data(); });
+				f(key(c, 2), d.ticks.data(), d.ticks.size(), [&](size_type n) { d.ticks.resize(n); return d.ticks.data(); });
+				f(key(c, 3), &d.grouped, 1, [&](size_type) { return &d.grouped; });
+				f(key(c, 4), &d.sorted, 1, [&](size_type) { return &d.sorted; });
+				f(key(c, 5), &d.groupSorted, 1, [&](size_type) { return &d.groupSorted; });
+				pages(d.entToComp, 8);
+			}
+			else
+				pages(d.bag, 8);
+			const Presence::Column col = Presence::column(c);
+			f(key(c, 6), col.words, col.size, [=](size_type n) { return Presence::resize(c, n, col.blocks).first; });
+			f(key(c, 7), col.summary, col.blocks, [=](size_type n) { return Presence::resize(c, Presence::column(c).size, n).second; });
+		}
+
+		std::unique_ptr<Frame[]>	_frames;
+		size_type					_capacity;
+		index_type					_first = 0;
+		size_type					_count = 0;
+		size_type					_chunks = 0;
+	};
+
+	/// Runs systems that declare the components they read and write.
+	/// Each run() orders the systems into a DAG: a system waits for every
+	/// earlier-registered system whose writes overlap its reads or writes,
+	/// or whose reads overlap its writes. Independent systems then run
+	/// concurrently on the ThreadPool, against the registry current on the
+	/// thread calling run(). In deterministic mode the systems run one after
+	/// the other in registration order.
+	/// Systems must not create or destroy entities, or add or remove
+	/// components, while others may be running. Record those into a
+	/// CommandBuffer and flush it after run().
+	/// Each system runs inside a Profiler::Scope named at add().
+	class Scheduler : NoCopy
+	{
+	public:
+		using System = void (*)(float);
+
+		void add(System fn, const Mask& reads, const Mask& writes, const char* name = "system") {
+			_systems.push({fn, reads, writes, 0, 0, name});
+		}
+		void deterministic(bool on) { _deterministic = on; }
+
+		void run(float dt) {
+			const size_type n = _systems.size();
+			if (_deterministic || ThreadPool::threads() == 1) {
+				for (index_type i = 0; i < n; ++i) {
+					const Profiler::Scope profile(_systems[i].name);
+					_systems[i].fn(dt);
+				}
+				return;
+			}
+
+			if (n > _capacity) {
+				_waiting.reset(new std::atomic<int>[n]);
+				_capacity = n;
+			}
+			_edges.clear();
+			for (index_type i = 0; i < n; ++i) {
+				SystemInfo& s = _systems[i];
+				s.firstEdge = _edges.size();
+				for (index_type j = i+1; j < n; ++j)
+					if (conflict(s, _systems[j]))
+						_edges.push(j);
+				s.edges = _edges.size() - s.firstEdge;
+				_waiting[i].store(0, std::memory_order_relaxed);
+			}
+			for (index_type e = 0; e < _edges.size(); ++e)
+				_waiting[_edges[e]].fetch_add(1, std::memory_order_relaxed);
+
+			// collect the roots before submitting, finished systems release their successors
+			_roots.clear();
+			for (index_type i = 0; i < n; ++i)
+				if (_waiting[i].load(std::memory_order_relaxed) == 0)
+					_roots.push(i);
+			_dt = dt;
+			_registry = &Registry::current();
+			_pending.store(n, std::memory_order_release);
+			for (index_type r = 0; r < _roots.size(); ++r)
+				ThreadPool::submit({runSystem, this, _roots[r]});
+			ThreadPool::wait(_pending);
+		}
+	private:
+		struct SystemInfo {
+			System		fn;
+			Mask		reads;
+			Mask		writes;
+			index_type	firstEdge;
+			size_type	edges;
+			const char*	name;
+		};
+
+		static bool conflict(const SystemInfo& a, const SystemInfo& b) {
+			return a.writes.testAny(b.writes) || a.writes.testAny(b.reads) || a.reads.testAny(b.writes);
+		}
+
+		static void runSystem(void* self, index_type i) {
+			Scheduler& s = *static_cast<Scheduler*>(self);
+			const SystemInfo& sys = s._systems[i];
+			{
+				const Registry::Scope scope(*s._registry);
+				const Profiler::Scope profile(sys.name);
+				sys.fn(s._dt);
+			}
+			for (index_type e = sys.firstEdge; e < sys.firstEdge + sys.edges; ++e) {
+				const index_type next = s._edges[e];
+				if (s._waiting[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+					ThreadPool::submit({runSystem, self, next});
+			}
+			s._pending.fetch_sub(1, std::memory_order_release);
+		}
+
+		DynamicBag<SystemInfo,16>			_systems;
+		DynamicBag<index_type,32>			_edges;
+		DynamicBag<index_type,16>			_roots;
+		std::unique_ptr<std::atomic<int>[]>	_waiting;
+		size_type							_capacity = 0;
+		std::atomic<int>					_pending{0};
+		float								_dt = 0;
+		Registry*							_registry = nullptr;
+		bool								_deterministic = false;
+	};
 }
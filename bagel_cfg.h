@@ -1,7 +1,12 @@
 #pragma once
 
 constexpr Bagel Params{
-	.DynamicResize = true
+	.DynamicResize = true,
+	.MaxComponents = 32
 };
 
+//the program's components, numbered at compile time, see ComponentList
+#define BAGEL_COMPONENTS worms::Position, worms::Health, worms::Physics, \
+	worms::Weapon, worms::ProjectileData, worms::Input, worms::Collectable
+
 //BAGEL_STORAGE(Position,PackedStorage)
@@ -0,0 +1,283 @@
+/**
+ * @file bench.cpp
+ * @brief bagel microbenchmarks on worms' component types
+ *
+ * usage: bagel_bench [--json out.json] [--baseline old.json] [--max n]
+ * Every benchmark runs in a fresh Registry a few times and keeps the
+ * fastest run. --json writes the results for later comparison, --baseline
+ * prints the change against such a file.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "worms.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace bagel;
+using namespace worms;
+
+struct BenchTag {};
+namespace bagel {
+	template <> struct Storage<BenchTag> { using type = TaggedStorage<BenchTag>; };
+}
+
+namespace {
+	/// Hardware cache misses of this thread, -1 where perf_event is unavailable.
+	class CacheMisses
+	{
+	public:
+		CacheMisses() {
+#ifdef __linux__
+			perf_event_attr attr{};
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+		}
+		~CacheMisses() {
+#ifdef __linux__
+			if (_fd >= 0)
+				close(_fd);
+#endif
+		}
+		void start() {
+#ifdef __linux__
+			if (_fd >= 0) {
+				ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+		}
+		long long stop() {
+			long long n = -1;
+#ifdef __linux__
+			if (_fd >= 0) {
+				ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+				if (read(_fd, &n, sizeof(n)) != sizeof(n))
+					n = -1;
+			}
+#endif
+			return n;
+		}
+	private:
+		int _fd = -1;
+	};
+
+	struct Result {
+		std::string	name;
+		double		nsPerOp;
+		double		entitiesPerSec;
+		double		missesPerOp;	///< negative when not counted
+	};
+
+	std::vector<Result> results;
+	CacheMisses misses;
+	volatile float sink;
+
+	/// Runs setup then body in a fresh registry `reps` times and records the
+	/// fastest body, which handles n entities.
+	template <class Setup, class Body>
+	void measure(const std::string& name, size_type n, Setup&& setup, Body&& body) {
+		const int reps = n >= 1000000 ? 3 : n >= 100000 ? 5 : 50;
+		double best = 1e300;
+		long long bestMisses = -1;
+		for (int r = 0; r < reps; ++r) {
+			Registry reg;
+			const Registry::Scope scope(reg);
+			setup();
+			misses.start();
+			const auto t = std::chrono::steady_clock::now();
+			body();
+			const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+			const long long m = misses.stop();
+			if (ns < best) {
+				best = ns;
+				bestMisses = m;
+			}
+		}
+		results.push_back({name + "/" + std::to_string(n), best/n, n / (best*1e-9),
+			bestMisses < 0 ? -1.0 : double(bestMisses)/n});
+		const Result& res = results.back();
+		printf("%-34s %10.2f ns/op %14.0f ent/s", res.name.c_str(), res.nsPerOp, res.entitiesPerSec);
+		if (res.missesPerOp >= 0)
+			printf(" %8.3f misses/op", res.missesPerOp);
+		printf("\n");
+	}
+
+	/// n entities shaped like a worms match: every one has a Position, half
+	/// have Physics, a quarter are players with Health and Input
+	void populate(std::vector<ent_type>& es) {
+		World::createEntities(es.size(), es.data());
+		for (index_type i = 0; i < index_type(es.size()); ++i) {
+			World::addComponent(es[i], Position{float(i), 0});
+			if (i % 2 == 0)
+				World::addComponent(es[i], Physics{0, 0, 1, 1});
+			if (i % 4 == 0) {
+				World::addComponent(es[i], Health{});
+				World::addComponent(es[i], Input{});
+			}
+		}
+	}
+
+	void benchEntities(size_type n) {
+		std::vector<ent_type> es(n);
+		measure("create", n, [] {}, [&] {
+			for (index_type i = 0; i < n; ++i)
+				es[i] = World::createEntity();
+		});
+		measure("createBatch", n, [] {}, [&] { World::createEntities(n, es.data()); });
+		measure("destroy", n, [&] { populate(es); }, [&] {
+			for (index_type i = 0; i < n; ++i)
+				World::destroyEntity(es[i]);
+		});
+		measure("destroyBatch", n, [&] { populate(es); }, [&] { World::destroyEntities(es.data(), n); });
+	}
+
+	/// add, get and del of T on n fresh entities
+	template <class T>
+	void benchStorage(const char* kind, size_type n, const T& value) {
+		std::vector<ent_type> es(n);
+		const auto create = [&] { World::createEntities(n, es.data()); };
+		const auto fill = [&] {
+			create();
+			for (index_type i = 0; i < n; ++i)
+				World::addComponent(es[i], value);
+		};
+		measure(std::string(kind) + ".add", n, create, [&] {
+			for (index_type i = 0; i < n; ++i)
+				World::addComponent(es[i], value);
+		});
+		measure(std::string(kind) + ".get", n, fill, [&] {
+			std::size_t sum = 0;
+			for (index_type i = 0; i < n; ++i)
+				sum += World::mask(es[i]).test(Component<T>::Bit);
+			if constexpr (!std::is_empty_v<T>)
+				for (index_type i = 0; i < n; ++i)
+					sum += reinterpret_cast<const unsigned char&>(World::getComponent<T>(es[i]));
+			sink = float(sum);
+		});
+		measure(std::string(kind) + ".del", n, fill, [&] {
+			for (index_type i = 0; i < n; ++i)
+				World::delComponent<T>(es[i]);
+		});
+	}
+
+	void benchQueries(size_type n) {
+		std::vector<ent_type> es(n);
+		std::vector<ent_type> found;
+		found.reserve(n);
+		const auto setup = [&] { populate(es); };
+
+		measure("scan", n, setup, [&] {
+			struct Out {
+				std::vector<ent_type>& v;
+				void push(ent_type e) { v.push_back(e); }
+			} out{found};
+			found.clear();
+			World::match(maskOf<Position, Health>(), out);
+		});
+		measure("each.Position,Health", n, setup, [&] {
+			World::each<Position, Health>([](ent_type, Position& p, Health& h) { p.x += h.value; });
+		});
+		measure("each.Position,Physics", n, setup, [&] {
+			World::each<Position, Physics>([](ent_type, Position& p, SoARef<Physics> ph) {
+				p.x += ph.get<&Physics::velX>();
+			});
+		});
+		measure("parallelEach.Position,Physics", n, setup, [&] {
+			World::parallelEach<Position, Physics>([](ent_type, Position& p, SoARef<Physics> ph) {
+				p.x += ph.get<&Physics::velX>();
+			});
+		});
+		measure("each.Position,Health,Input", n, setup, [&] {
+			World::each<Position, Health, Input>([](ent_type, Position& p, Health& h, Input& in) {
+				p.x += h.value * in.moveDirection;
+			});
+		});
+	}
+
+	bool writeJson(const char* path) {
+		FILE* f = fopen(path, "w");
+		if (!f)
+			return false;
+		fprintf(f, "[\n");
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const Result& r = results[i];
+			fprintf(f, "{\"name\": \"%s\", \"ns_per_op\": %.4f, \"entities_per_s\": %.1f, \"cache_misses_per_op\": ",
+				r.name.c_str(), r.nsPerOp, r.entitiesPerSec);
+			if (r.missesPerOp >= 0)
+				fprintf(f, "%.4f}", r.missesPerOp);
+			else
+				fprintf(f, "null}");
+			fprintf(f, i+1 < results.size() ? ",\n" : "\n");
+		}
+		fprintf(f, "]\n");
+		return fclose(f) == 0;
+	}
+
+	/// prints the ns/op change against a file written by --json, one
+	/// result per line as writeJson() puts them
+	bool diffBaseline(const char* path) {
+		FILE* f = fopen(path, "r");
+		if (!f)
+			return false;
+		printf("\n%-34s %10s %10s %8s\n", "vs baseline", "old ns", "new ns", "change");
+		char line[512];
+		while (fgets(line, sizeof(line), f)) {
+			char name[256];
+			double ns;
+			if (sscanf(line, " {\"name\": \"%255[^\"]\", \"ns_per_op\": %lf", name, &ns) != 2)
+				continue;
+			for (const Result& r : results)
+				if (r.name == name)
+					printf("%-34s %10.2f %10.2f %+7.1f%%\n", name, ns, r.nsPerOp, (r.nsPerOp/ns - 1) * 100);
+		}
+		fclose(f);
+		return true;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const char* json = nullptr;
+	const char* baseline = nullptr;
+	size_type max = 1000000;
+	for (int i = 1; i+1 < argc; i += 2) {
+		if (strcmp(argv[i], "--json") == 0)
+			json = argv[i+1];
+		else if (strcmp(argv[i], "--baseline") == 0)
+			baseline = argv[i+1];
+		else if (strcmp(argv[i], "--max") == 0)
+			max = atoi(argv[i+1]);
+	}
+
+	for (size_type n : {1000, 100000, 1000000}) {
+		if (n > max)
+			break;
+		benchEntities(n);
+		benchStorage("sparse", n, Input{1.0f, true, false, 0.5f});
+		benchStorage("packed", n, Health{});
+		benchStorage("tagged", n, BenchTag{});
+		benchQueries(n);
+	}
+
+	if (json && !writeJson(json)) {
+		fprintf(stderr, "cannot write %s\n", json);
+		return 1;
+	}
+	if (baseline && !diffBaseline(baseline)) {
+		fprintf(stderr, "cannot read %s\n", baseline);
+		return 1;
+	}
+	return 0;
+}
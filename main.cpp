@@ -1,7 +1,13 @@
 #include <SDL3/SDL.h>
 #include <SDL3_image/SDL_image.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <vector>
+#include "worms.h"
 using namespace std;
 #define GROUND_R 140
 #define GROUND_G 70
@@ -17,6 +23,7 @@ const int TURN_DURATION = 200;
 const int LEFT_MOVE_LENGTH = -10.0f;
 const int RIGHT_MOVE_LENGTH = 10.0f;
 const int FLOOR_HEIGHT = 500;
+const float STEP_TIME = 0.01f; //seconds the ECS systems advance per step
 
 
 struct Worm {
@@ -85,41 +92,54 @@ struct Terrain {
 
 };
 
-int main(int argc, char* argv[]) {
-    Terrain terrain(SCREEN_WIDTH, SCREEN_HEIGHT);
+//one match, stepped the same way live and in replay
+struct Match {
+    Terrain terrain{SCREEN_WIDTH, SCREEN_HEIGHT};
     std::vector<Worm> worms;
+    std::vector<bagel::Entity> players; //each worm's entity, same order as worms
+    bagel::Scheduler scheduler;
     int currentWorm = 0;  //current worm turn
     int turnTimer = 0;    //track how much time left for current turn
-    worms.emplace_back(100, FLOOR_HEIGHT - WORM_SIZE);
-    worms.emplace_back(300, FLOOR_HEIGHT - WORM_SIZE);
-    worms.emplace_back(500, FLOOR_HEIGHT - WORM_SIZE);
-    SDL_Window* window = nullptr;
-    SDL_Renderer* renderer = nullptr;
 
-    if (!SDL_Init(SDL_INIT_VIDEO)) {
-		cout << SDL_GetError() << endl;
-        return -1;
-    }
-    if (!SDL_CreateWindowAndRenderer("Worms", SCREEN_WIDTH, SCREEN_HEIGHT, 0, &window, &renderer)) {
-        cout << SDL_GetError() << endl;
-        return -1;
+    Match() {
+        worms.emplace_back(100, FLOOR_HEIGHT - WORM_SIZE);
+        worms.emplace_back(300, FLOOR_HEIGHT - WORM_SIZE);
+        worms.emplace_back(500, FLOOR_HEIGHT - WORM_SIZE);
+        worms::registerSystems(scheduler);
+        for (const auto& worm : worms) {
+            players.push_back(worms::createPlayer(worm.x, worm.y));
+        }
     }
 
-    while (true) {
-        //timer for turn increase
-        turnTimer++;
-        Worm& activeWorm = worms[currentWorm];
-        //for simulation, randomally make worm do one of three moves, move right, move left or jump
-        if (turnTimer % (TURN_DURATION/10) == 0) {
+    //for simulation, randomally make worm do one of three moves, move right, move left or jump
+    worms::Input randomInput() const {
+        worms::Input input;
+        if ((turnTimer + 1) % (TURN_DURATION/10) == 0) {
             int action = rand() % 3;
             if (action == 0) {
-                activeWorm.move(LEFT_MOVE_LENGTH);
+                input.moveDirection = -1.0f;
             } else if (action == 1) {
-                activeWorm.move(RIGHT_MOVE_LENGTH);
+                input.moveDirection = 1.0f;
             } else {
-                activeWorm.jump();
+                input.jump = true;
             }
         }
+        return input;
+    }
+
+    void step(const worms::Input& input) {
+        const bagel::Profiler::Scope profile("step");
+        //timer for turn increase
+        turnTimer++;
+        Worm& activeWorm = worms[currentWorm];
+        players[currentWorm].get<worms::Input>() = input;
+        if (input.moveDirection < 0) {
+            activeWorm.move(LEFT_MOVE_LENGTH);
+        } else if (input.moveDirection > 0) {
+            activeWorm.move(RIGHT_MOVE_LENGTH);
+        } else if (input.jump) {
+            activeWorm.jump();
+        }
         //switch to next worm if turn duration passed
         if (turnTimer >= TURN_DURATION) {
             currentWorm = (currentWorm + 1) % worms.size();
@@ -139,6 +159,13 @@ int main(int argc, char* argv[]) {
                 worm.vy = 0;
             }
         }
+        //independent systems run in parallel, reactive ones after them
+        scheduler.run(STEP_TIME);
+        bagel::World::deliver();
+        bagel::World::advanceTick();
+    }
+
+    void draw(SDL_Renderer* renderer) {
         //clear screen
         SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255); //blue sky
         SDL_RenderClear(renderer);
@@ -152,8 +179,110 @@ int main(int argc, char* argv[]) {
             }
             SDL_RenderFillRect(renderer, &worm.rect);
         }
+    }
+
+    void render(SDL_Renderer* renderer) {
+        {
+            const bagel::Profiler::Scope profile("render");
+            draw(renderer);
+        }
+        const bagel::Profiler::Scope profile("present");
         SDL_RenderPresent(renderer);
+    }
+};
+
+//steps a recorded match with no window and no delay, as fast as possible
+int replay(const char* path) {
+    worms::InputLog log;
+    if (!worms::InputLog::load(path, log)) {
+        cout << "cannot read input log " << path << endl;
+        return -1;
+    }
+    srand(log.seed());
+    Match match;
+    //systems run one after the other in registration order, so replays repeat exactly
+    match.scheduler.deterministic(true);
+    std::vector<worms::Input> inputs(match.worms.size());
+    worms::InputReplay replay(log);
+    int ticks = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (replay.nextTick()) {
+        for (const auto& change : replay.changes()) {
+            if (static_cast<std::size_t>(change.id) < inputs.size()) {
+                inputs[change.id] = change.input;
+            }
+        }
+        match.step(inputs[match.currentWorm]);
+        ticks++;
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cout << "replayed " << ticks << " of " << log.ticks() << " ticks in " << ms << " ms" << endl;
+    for (const auto& worm : match.worms) {
+        cout << "worm at " << worm.x << ", " << worm.y << endl;
+    }
+    return ticks == log.ticks() ? 0 : -1;
+}
+
+//usage: BAGEL [--seed n] [--record log] [--profile trace.json] | --replay log
+int main(int argc, char* argv[]) {
+    const char* recordPath = nullptr;
+    const char* profilePath = nullptr;
+    std::uint32_t seed = static_cast<std::uint32_t>(time(nullptr));
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--replay") == 0) {
+            return replay(argv[i + 1]);
+        } else if (strcmp(argv[i], "--record") == 0) {
+            recordPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profilePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = static_cast<std::uint32_t>(strtoul(argv[i + 1], nullptr, 10));
+        }
+    }
+    srand(seed);
+    //frame markers are written on exit, open the file in chrome://tracing
+    bagel::Profiler::enable(profilePath != nullptr);
+    worms::InputLog log(seed);
+    Match match;
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
+		cout << SDL_GetError() << endl;
+        return -1;
+    }
+    if (!SDL_CreateWindowAndRenderer("Worms", SCREEN_WIDTH, SCREEN_HEIGHT, 0, &window, &renderer)) {
+        cout << SDL_GetError() << endl;
+        return -1;
+    }
+
+    bool running = true;
+    while (running) {
+        const bagel::Profiler::Scope frame("frame");
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_EVENT_QUIT) {
+                running = false;
+            }
+        }
+        const worms::Input input = match.randomInput();
+        //every worm's input is logged, only changes take space
+        for (int i = 0; i < static_cast<int>(match.worms.size()); i++) {
+            log.record(i, i == match.currentWorm ? input : worms::Input{});
+        }
+        log.endTick();
+        match.step(input);
+        match.render(renderer);
         SDL_Delay(10);
     }
+    if (recordPath && !log.save(recordPath)) {
+        cout << "cannot write input log " << recordPath << endl;
+    }
+    if (profilePath && !bagel::Profiler::write(profilePath)) {
+        cout << "cannot write profile " << profilePath << endl;
+    }
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
     return 0;
-}
\ No newline at end of file
+}
@@ -1,9 +1,51 @@
 #include <iostream>
 #include <cassert>
-#include "bagel.h"
+#include <cstring>
+#include <string>
+#include <vector>
+#include "worms.h"
 using namespace std;
 using namespace bagel;
 
+struct TestPos { float x, y; };
+struct TestVel { float dx, dy; };
+struct TestTag {};
+struct TestA { int a; };
+struct TestB { double b; };
+struct TestS { int s; };
+struct TestSoA { float x; int y; };
+struct TestFlag {};
+struct TestTracked {
+	static inline int live = 0;
+	std::vector<int> items;
+	TestTracked(int n = 0) : items(n, n) { ++live; }
+	TestTracked(const TestTracked& o) : items(o.items) { ++live; }
+	TestTracked(TestTracked&& o) noexcept : items(std::move(o.items)) { ++live; }
+	TestTracked& operator=(const TestTracked&) = default;
+	TestTracked& operator=(TestTracked&&) = default;
+	~TestTracked() { --live; }
+};
+struct TestName { std::string s; };
+struct TestFixed {
+	explicit TestFixed(int v) : v(v) {}
+	int v;
+};
+struct TestNode { int local, world; };
+namespace bagel {
+	template <> struct Storage<TestPos> { using type = PackedStorage<TestPos>; };
+	template <> struct Storage<TestVel> { using type = PackedStorage<TestVel>; };
+	template <> struct Storage<TestA> { using type = ArchetypeStorage<TestA>; };
+	template <> struct Storage<TestB> { using type = ArchetypeStorage<TestB>; };
+	template <> struct Storage<TestSoA> { using type = SoAStorage<TestSoA>; };
+	template <> struct Storage<TestFlag> { using type = TaggedStorage<TestFlag>; };
+	template <> struct Storage<TestTracked> { using type = PackedStorage<TestTracked>; };
+	template <> struct Storage<TestFixed> { using type = PackedStorage<TestFixed>; };
+	template <> struct Storage<TestNode> { using type = HierarchyStorage<TestNode>; };
+	template <> struct SoAFields<TestSoA> {
+		static constexpr auto list = std::make_tuple(&TestSoA::x, &TestSoA::y);
+	};
+}
+
 void test1() {
 	ent_type e0 = World::createEntity();
 	assert(e0.id == 0 && "First id is not 0");
@@ -18,7 +60,1007 @@ void test1() {
 	cout << "Test 1 passed\n";
 }
 
+void test2() {
+	ent_type es[20];
+	for (ent_type& e : es)
+		e = World::createEntity();
+	for (int i = 0; i < 20; ++i) {
+		World::addComponent(es[i], TestPos{float(i), 0});
+		if (i % 4 == 0)
+			World::addComponent(es[i], TestVel{1, 1});
+	}
+	World::destroyEntity(es[8]);
+
+	int count = 0;
+	World::each<TestPos, TestVel>([&](ent_type e, TestPos& p, TestVel& v) {
+		assert(int(p.x) % 4 == 0 && e.id != es[8].id && "View visited a non-matching entity");
+		p.x += v.dx;
+		++count;
+	});
+	assert(count == 4 && "View did not visit every matching entity");
+
+	for (int i = 0; i < 20; ++i)
+		if (i != 8)
+			World::destroyEntity(es[i]);
+	cout << "Test 2 passed\n";
+}
+
+void test3() {
+	ent_type es[1000];
+	for (int i = 0; i < 1000; ++i) {
+		es[i] = World::createEntity();
+		World::addComponent(es[i], TestA{i});
+		if (i % 2 == 0)
+			World::addComponent(es[i], TestB{i*0.5});
+	}
+	for (int i = 0; i < 1000; i += 4)
+		World::delComponent<TestA>(es[i]);
+	World::destroyEntity(es[2]);
+
+	for (int i = 0; i < 1000; ++i) {
+		if (i % 4 != 0 && i != 2)
+			assert(World::getComponent<TestA>(es[i]).a == i && "Archetype lost a component");
+		if (i % 2 == 0 && i != 2)
+			assert(World::getComponent<TestB>(es[i]).b == i*0.5 && "Archetype lost a component");
+	}
+
+	int count = 0;
+	World::each<TestA, TestB>([&](ent_type e, TestA& a, TestB& b) {
+		assert(a.a % 4 == 2 && a.a != 2 && b.b == a.a*0.5 && World::mask(e).test(Component<TestB>::Bit));
+		++count;
+	});
+	assert(count == 249 && "Archetype view did not visit every matching entity");
+
+	for (int i = 0; i < 1000; ++i)
+		if (i != 2)
+			World::destroyEntity(es[i]);
+	cout << "Test 3 passed\n";
+}
+
+void test4() {
+	ent_type es[300];
+	for (int i = 0; i < 300; ++i) {
+		es[i] = World::createEntity();
+		if (i % 2 == 0)
+			World::addComponent(es[i], TestPos{});
+		if (i % 3 == 0)
+			World::addComponent(es[i], TestVel{});
+		if (i % 5 == 0)
+			World::addComponent(es[i], TestA{i});
+	}
+	const Mask pos = MaskBuilder().set<TestPos>().build();
+	const Mask vel = MaskBuilder().set<TestVel>().build();
+	const Mask a = MaskBuilder().set<TestA>().build();
+
+	DynamicBag<ent_type,16> ids;
+	World::match(pos, vel, a, ids);
+	int expected = 0;
+	for (int i = 0; i < 300; ++i)
+		if (i % 2 == 0 && i % 3 == 0 && i % 5 != 0)
+			++expected;
+	assert(ids.size() == expected && "match returned a wrong count");
+	for (int i = 0; i < ids.size(); ++i) {
+		const Entity e(ids[i]);
+		assert(e.has<TestPos>() && e.has<TestVel>() && !e.has<TestA>() && "match returned a wrong id");
+	}
+
+	std::uint64_t bits[64];
+	expected = 0;
+	for (int i = 0; i < 300; ++i)
+		if (i % 2 != 0 && (i % 3 == 0 || i % 5 == 0))
+			++expected;
+	assert(World::matchBits(Mask{}, Mask{}, pos, bits) == expected && "matchBits miscounted");
+	for (int i = 0; i < 300; ++i)
+		assert(bool(bits[es[i].id/64] >> es[i].id%64 & 1) == (i % 2 != 0 && (i % 3 == 0 || i % 5 == 0)));
+
+	for (ent_type& e : es)
+		World::destroyEntity(e);
+	cout << "Test 4 passed\n";
+}
+
+void test5() {
+	ent_type es[10000];
+	for (int i = 0; i < 10000; ++i) {
+		es[i] = World::createEntity();
+		if (i % 3 == 0)
+			World::addComponent(es[i], TestS{i});
+		if (i < 100 || i > 9000)
+			World::addComponent(es[i], TestTag{});
+	}
+	World::delComponent<TestS>(es[9003]);
+
+	int count = 0;
+	World::each<TestS, TestTag>([&](ent_type e, TestS& s, TestTag&) {
+		assert(s.s % 3 == 0 && (s.s < 100 || s.s > 9000) && s.s != 9003 && Presence::test(Component<TestTag>::Index, e));
+		++count;
+	});
+	assert(count == 34+333-1 && "Presence query did not visit every matching entity");
+
+	for (ent_type& e : es)
+		World::destroyEntity(e);
+	assert(!Presence::test(Component<TestS>::Index, es[0]) && "destroyEntity left a presence bit");
+	cout << "Test 5 passed\n";
+}
+
+void test6() {
+	ent_type es[100];
+	for (int i = 0; i < 100; ++i) {
+		es[i] = World::createEntity();
+		World::addComponent(es[i], TestSoA{float(i), i});
+	}
+	World::delComponent<TestSoA>(es[10]);
+
+	float* xs = SoAStorage<TestSoA>::field<&TestSoA::x>();
+	assert(SoAStorage<TestSoA>::size() == 99 && reinterpret_cast<std::uintptr_t>(xs) % 64 == 0);
+	for (int i = 0; i < SoAStorage<TestSoA>::size(); ++i)
+		xs[i] *= 2;
+
+	for (int i = 0; i < 100; ++i)
+		if (i != 10) {
+			const TestSoA t = World::getComponent<TestSoA>(es[i]);
+			assert(t.x == 2*i && t.y == i && "SoA storage lost a field");
+		}
+	World::getComponent<TestSoA>(es[5]) = TestSoA{1, 2};
+	assert(World::getComponent<TestSoA>(es[5]).get<&TestSoA::y>() == 2);
+
+	for (ent_type& e : es)
+		World::destroyEntity(e);
+	cout << "Test 6 passed\n";
+}
+
+void test7() {
+	ent_type es[5000];
+	World::createEntities(5000, es);
+	TestPos ps[5000];
+	TestSoA ss[5000];
+	for (int i = 0; i < 5000; ++i) {
+		ps[i] = {float(i), 0};
+		ss[i] = {0, i+1000};
+	}
+	World::addComponents(es, 5000, ps);
+	World::addComponents(es+1000, 1000, ss);
+
+	int count = 0;
+	World::each<TestPos, TestSoA>([&](ent_type e, TestPos& p, SoARef<TestSoA> s) {
+		assert(p.x >= 1000 && p.x < 2000 && s.get<&TestSoA::y>() == p.x && es[int(p.x)].id == e.id);
+		++count;
+	});
+	assert(count == 1000 && "Batched components are missing");
+
+	for (ent_type& e : es)
+		World::destroyEntity(e);
+	cout << "Test 7 passed\n";
+}
+
+void test8() {
+	ent_type es[100];
+	World::createEntities(100, es);
+	for (int i = 0; i < 100; ++i)
+		World::addComponent(es[i], TestPos{float(i), 0});
+
+	CommandBuffer a, b;
+	const ent_type made = a.create();
+	a.add(made, TestPos{-1, 0});
+	a.add(made, TestA{7});
+	for (int i = 0; i < 100; i += 2)
+		(i % 4 ? a : b).del<TestPos>(es[i]);
+	b.del<TestPos>(es[0]);
+	b.destroy(es[1]);
+	b.destroy(es[1]);
+	assert(World::mask(es[3]).test(Component<TestPos>::Bit) && "Buffered commands applied early");
+
+	CommandBuffer* bufs[] = {&a, &b};
+	CommandBuffer::flush(bufs, 2);
+
+	int count = 0;
+	ent_type created = {-1};
+	World::each<TestPos>([&](ent_type e, TestPos& p) {
+		assert((p.x == -1 || int(p.x) % 2 == 1) && "Buffered removal failed");
+		if (p.x == -1)
+			created = e;
+		++count;
+	});
+	assert(count == 49 + 1 && "Buffered removal or destroy failed");
+	assert(Entity{created}.has<TestA>() && Entity{created}.get<TestA>().a == 7 && "Buffered add failed");
+	assert(!World::mask(es[1]).test(Component<TestPos>::Bit) && "Buffered destroy failed");
+
+	World::destroyEntity(created);
+	for (int i = 3; i < 100; i += 2)
+		World::destroyEntity(es[i]);
+	for (int i = 0; i < 100; i += 2)
+		World::destroyEntity(es[i]);
+	assert(Storage<TestPos>::type::size() == 0 && "Destroy left components behind");
+	cout << "Test 8 passed\n";
+}
+
+std::atomic<int> clock9;
+int stamps9[4];
+template <int I>
+void system9(float) {
+	// every system touches TestPos only as declared
+	float sum = 0;
+	for (int i = 0; i < 1000 && I != 2; ++i)
+		World::each<TestPos>([&](ent_type, TestPos& p) {
+			if constexpr (I == 0 || I == 3)
+				p.y += I;
+			else
+				sum += p.y;
+		});
+	stamps9[I] = ++clock9 + int(sum * 0);
+}
+
+void test9() {
+	ent_type es[100];
+	World::createEntities(100, es);
+	for (ent_type e : es)
+		World::addComponent(e, TestPos{0, 0});
+
+	Scheduler s;
+	s.add(system9<0>, MaskBuilder().build(), MaskBuilder().set<TestPos>().build());
+	s.add(system9<1>, MaskBuilder().set<TestPos>().build(), MaskBuilder().set<TestVel>().build());
+	s.add(system9<2>, MaskBuilder().build(), MaskBuilder().set<TestS>().build());
+	s.add(system9<3>, MaskBuilder().build(), MaskBuilder().set<TestPos>().build());
+	for (int frame = 0; frame < 20; ++frame) {
+		s.run(0);
+		assert(stamps9[0] < stamps9[1] && stamps9[1] < stamps9[3] && "Conflicting systems overlapped");
+	}
+	s.deterministic(true);
+	s.run(0);
+	assert(stamps9[0] < stamps9[1] && stamps9[1] < stamps9[2] && stamps9[2] < stamps9[3] && "Deterministic order broken");
+
+	for (ent_type e : es)
+		World::destroyEntity(e);
+	cout << "Test 9 passed\n";
+}
+
+void test10() {
+	ent_type es[10000];
+	World::createEntities(10000, es);
+	for (int i = 0; i < 10000; ++i) {
+		World::addComponent(es[i], TestPos{0, 0});
+		if (i % 3)
+			World::addComponent(es[i], TestVel{float(i), 1});
+	}
+
+	std::atomic<int> count{0};
+	World::parallelEach<TestPos, TestVel>([&](ent_type, TestPos& p, TestVel& v) {
+		p.x += v.dx;
+		p.y += v.dy;
+		++count;
+	}, 64);
+	assert(count == 6666 && "Parallel iteration missed entities");
+	for (int i = 0; i < 10000; ++i) {
+		const TestPos& p = Entity{es[i]}.get<TestPos>();
+		assert(p.x == (i % 3 ? i : 0) && p.y == (i % 3 ? 1 : 0) && "Entity visited more or less than once");
+	}
+
+	for (ent_type e : es)
+		World::destroyEntity(e);
+
+	// sparse Input is first touched by the workers, which all must share one state
+	Registry r;
+	const Registry::Scope scope(r);
+	World::createEntities(10000, es);
+	for (ent_type e : es)
+		World::addComponent(e, TestPos{0, 0});
+	World::parallelEach<TestPos, worms::Input>([&](ent_type, TestPos&, worms::Input&) { ++count; }, 64);
+	assert(count == 6666 && "Iterated a component no entity has");
+	cout << "Test 10 passed\n";
+}
+
+template <Allocation A>
+void grow11(bool stays) {
+	const std::size_t big = std::size_t{3} << 20;
+	char* p = static_cast<char*>(BagMemory::allocate<A>(64));
+	for (int i = 0; i < 64; ++i)
+		p[i] = char(i);
+	char* q = static_cast<char*>(BagMemory::grow<A>(p, 64, big));
+	assert(q && (!stays || q == p) && "Reserved memory moved");
+	for (int i = 0; i < 64; ++i)
+		assert(q[i] == char(i) && "Grown memory lost its contents");
+	q[big-1] = 1;
+	assert((A == Allocation::Malloc || reinterpret_cast<std::uintptr_t>(q) % BagMemory::Alignment == 0) && "Misaligned");
+	BagMemory::release<A>(q, big);
+}
+
+void test11() {
+	grow11<Allocation::Malloc>(false);
+	grow11<Allocation::Aligned>(false);
+	grow11<Allocation::HugePages>(false);
+	grow11<Allocation::Reserve>(true);
+	cout << "Test 11 passed\n";
+}
+
+void match12(int seed, int* result) {
+	Registry r;
+	const Registry::Scope scope(r);
+	ent_type es[1000];
+	World::createEntities(1000, es);
+	for (int i = 0; i < 1000; ++i) {
+		World::addComponent(es[i], TestPos{float(seed), 0});
+		if (i % 2)
+			World::addComponent(es[i], TestA{seed});
+	}
+	int sum = 0;
+	World::each<TestPos, TestA>([&](ent_type, TestPos& p, TestA& a) { sum += int(p.x) + a.a; });
+	*result = World::maxId().id == 999 ? sum : -1;
+}
+
+void test12() {
+	const ent_type outside = World::createEntity();
+	World::addComponent(outside, TestPos{-1, 0});
+
+	int results[2];
+	std::thread a(match12, 1, &results[0]), b(match12, 2, &results[1]);
+	a.join();
+	b.join();
+	assert(results[0] == 500*2 && results[1] == 500*4 && "Registries share state");
+
+	int count = 0;
+	World::each<TestPos>([&](ent_type, TestPos& p) { count += p.x == -1; });
+	assert(count == 1 && Storage<TestPos>::type::size() == 1 && "Default registry changed");
+	World::destroyEntity(outside);
+	cout << "Test 12 passed\n";
+}
+
+void test13() {
+	Registry r;
+	const Registry::Scope scope(r);
+	using Pos = Storage<TestPos>::type;
+	using Vel = Storage<TestVel>::type;
+	ent_type es[3000];
+	World::createEntities(3000, es);
+	for (int i = 0; i < 3000; ++i) {
+		World::addComponent(es[i], TestPos{float(i), 0});
+		if (i % 3 == 0)
+			World::addComponent(es[i], TestVel{float(i), 0});
+	}
+	assert((World::group<TestPos, TestVel>()) && "Group refused free storages");
+	assert(!(World::group<TestVel, TestSoA>()) && "Storage owned by two groups");
+
+	for (int i = 1; i < 3000; i += 3)
+		World::addComponent(es[i], TestVel{float(i), 0});
+	for (int i = 0; i < 3000; i += 9)
+		World::delComponent<TestPos>(es[i]);
+	for (int i = 1; i < 3000; i += 7)
+		World::destroyEntity(es[i]);
+
+	auto check = [&] {
+		int expected = 0;
+		for (int i = 0; i < 3000; ++i)
+			expected += World::mask(es[i]).test(MaskBuilder().set<TestPos>().set<TestVel>().build());
+		assert((Group<TestPos, TestVel>::size()) == size_type(expected) && "Group size wrong");
+		for (index_type i = 0; i < expected; ++i)
+			assert(Pos::entity(i).id == Vel::entity(i).id && "Group prefix out of lockstep");
+		int visited = 0;
+		World::each<TestPos, TestVel>([&](ent_type e, TestPos& p, TestVel& v) {
+			assert(p.x == v.dx && float(e.id) == p.x && "Group visited wrong pair");
+			++visited;
+		});
+		assert(visited == expected && "Group visit count wrong");
+	};
+	check();
+
+	// leaving the group from inside the loop
+	World::each<TestPos, TestVel>([](ent_type e, TestPos&, TestVel&) {
+		if (e.id % 2)
+			World::delComponent<TestVel>(e);
+	});
+	check();
+	cout << "Test 13 passed\n";
+}
+
+void test14() {
+	Registry r;
+	const Registry::Scope scope(r);
+	using Pos = Storage<TestPos>::type;
+	using Vel = Storage<TestVel>::type;
+	ent_type es[4000];
+	World::createEntities(4000, es);
+	for (int i = 0; i < 4000; ++i) {
+		World::addComponent(es[i], TestPos{float(i), 0});
+		if (i % 2)
+			World::addComponent(es[i], TestVel{float(i), 0});
+	}
+	for (int i = 0; i < 4000; i += 5)
+		World::delComponent<TestPos>(es[i]);
+	for (int i = 1; i < 4000; i += 6)
+		World::delComponent<TestVel>(es[i]);
+
+	int calls = 1;
+	while (!Pos::sort(IdOrder{}, std::chrono::microseconds(0)))
+		++calls;
+	assert(calls > 1 && "Sort ignored its budget");
+	for (index_type i = 1; i < Pos::size(); ++i)
+		assert(Pos::entity(i-1).id < Pos::entity(i).id && "Sort left slots out of order");
+	assert(Pos::get(es[7]).x == 7 && "Sort lost a component");
+
+	Vel::sortAs<TestPos>();
+	for (index_type i = 1; i < Vel::size(); ++i) {
+		const ent_type a = Vel::entity(i-1), b = Vel::entity(i);
+		const bool pa = Entity{a}.has<TestPos>(), pb = Entity{b}.has<TestPos>();
+		assert((pa && pb ? Pos::index(a) < Pos::index(b) : pa || a.id < b.id) && "sortAs missed the order");
+	}
+
+	World::group<TestPos, TestVel>();
+	for (int i = 3; i < 4000; i += 7)
+		World::destroyEntity(es[i]);
+	const size_type grouped = Group<TestPos, TestVel>::size();
+	Group<TestPos, TestVel>::sort();
+	for (index_type i = 0; i < grouped; ++i) {
+		assert(Pos::entity(i).id == Vel::entity(i).id && "Group sort broke lockstep");
+		assert((i == 0 || Pos::entity(i-1).id < Pos::entity(i).id) && "Group sort left slots out of order");
+	}
+	Pos::sort();
+	for (index_type i = grouped+1; i < Pos::size(); ++i)
+		assert(Pos::entity(i-1).id < Pos::entity(i).id && "Sort crossed the group prefix");
+	cout << "Test 14 passed\n";
+}
+
+void test15() {
+	Registry r;
+	const Registry::Scope scope(r);
+	using Flags = Storage<TestFlag>::type;
+	ent_type es[2000];
+	World::createEntities(2000, es);
+	for (int i = 0; i < 2000; ++i) {
+		World::addComponent(es[i], TestPos{float(i), 0});
+		if (i % 2)
+			World::addComponent(es[i], TestA{i});
+		if (i % 10 == 0)
+			World::addComponent(es[i], TestFlag{});
+	}
+	World::delComponent<TestFlag>(es[0]);
+	World::destroyEntity(es[10]);
+	assert(Flags::size() == 198 && Flags::has(es[20]) && !Flags::has(es[0]) && !Flags::has(es[21]) && "Tag bitset wrong");
+
+	int count = 0;
+	World::each<TestFlag>([&](ent_type e) {
+		assert(e.id % 10 == 0 && Entity{e}.has<TestFlag>() && "Tag visited an untagged entity");
+		++count;
+	});
+	assert(count == 198 && "Tag-only view miscounted");
+
+	count = 0;
+	World::each<TestPos, TestFlag>([&](ent_type e, TestPos& p) {
+		assert(int(p.x) == e.id && e.id % 10 == 0 && "Tagged view passed the wrong component");
+		++count;
+	});
+	assert(count == 198 && "Tagged view miscounted");
+
+	std::atomic<int> tagged{0};
+	World::parallelEach<TestFlag, TestPos>([&](ent_type e, TestPos& p) { tagged += int(p.x) == e.id; }, 16);
+	assert(tagged == 198 && "Tag-driven parallelEach miscounted");
+
+	for (int i = 1; i < 2000; i += 100)
+		World::addComponent(es[i], TestFlag{});
+	count = 0;
+	World::each<TestFlag, TestA>([&](ent_type e, TestA& a) {
+		assert(a.a == e.id && a.a % 100 == 1 && "Tag and archetype view matched wrong ids");
+		++count;
+	});
+	assert(count == 20 && "Tag and archetype view miscounted");
+	cout << "Test 15 passed\n";
+}
+
+void test16() {
+	{
+		Registry r;
+		const Registry::Scope scope(r);
+		ent_type es[500];
+		World::createEntities(500, es);
+		for (int i = 0; i < 500; ++i) {
+			if (i % 2)
+				World::emplaceComponent<TestTracked>(es[i], i);
+			else {
+				TestTracked t(i);
+				World::addComponent(es[i], std::move(t));
+				assert(t.items.empty() && "add copied an rvalue");
+			}
+			Entity{es[i]}.add(TestName{std::string(40, char('a' + i % 26))});
+		}
+		assert(TestTracked::live == 500 && "Bag growth leaked or lost components");
+
+		for (int i = 0; i < 500; i += 3)
+			World::delComponent<TestTracked>(es[i]);
+		for (int i = 1; i < 500; i += 7)
+			World::destroyEntity(es[i]);
+		CommandBuffer b;
+		b.emplace<TestTracked>(es[0], 3);
+		b.flush();
+
+		int count = 0;
+		World::each<TestTracked>([&](ent_type e, TestTracked& t) {
+			const int n = e.id == es[0].id ? 3 : e.id;
+			assert(int(t.items.size()) == n && (n == 0 || t.items[0] == n) && "Component moved badly");
+			++count;
+		});
+		assert(TestTracked::live == count && "Removal leaked components");
+		assert(Entity{es[499]}.get<TestName>().s == std::string(40, char('a' + 499 % 26)) && "Sparse string lost");
+
+		// removal only destroys, so T needs no default constructor
+		for (int i = 2; i < 500; i += 7)
+			World::emplaceComponent<TestFixed>(es[i], i);
+		World::delComponent<TestFixed>(es[2]);
+		std::vector<ent_type> doomed;
+		for (int i = 100; i < 200; ++i)
+			if (i % 7 == 2)
+				doomed.push_back(es[i]);
+		World::destroyEntities(doomed.data(), doomed.size());
+		int fixed = 0;
+		World::each<TestFixed>([&](ent_type e, TestFixed& f) {
+			assert(f.v == e.id && (e.id < 100 || e.id >= 200) && "Component without default constructor lost");
+			++fixed;
+		});
+		assert(fixed == 72 - 1 - 15 && "Components without default constructor miscounted");
+	}
+	assert(TestTracked::live == 0 && "Registry leaked components");
+	cout << "Test 16 passed\n";
+}
+
+void test17() {
+	Registry r;
+	const Registry::Scope scope(r);
+	static ent_type es[300000];
+	World::createEntities(300000, es);
+	const ent_type rare = es[299999];
+	World::addComponent(es[3], TestPos{3, 0});
+	World::addComponent(rare, TestPos{-1, 0});
+	World::addComponent(rare, TestS{7});
+	World::addComponent(es[4], TestS{4});
+
+	assert(Storage<TestPos>::type::data().entToComp.allocated() == 2 && "Packed index allocated untouched pages");
+	assert(Storage<TestS>::type::data().bag.allocated() == 2 && "Sparse bag allocated untouched pages");
+	assert(Entity{rare}.get<TestS>().s == 7 && Entity{es[4]}.get<TestS>().s == 4 && "Sparse lookup failed");
+	assert(Entity{rare}.get<TestPos>().x == -1 && Entity{es[3]}.get<TestPos>().x == 3 && "Packed lookup failed");
+
+	int count = 0;
+	World::each<TestPos, TestS>([&](ent_type e, TestPos& p, TestS& t) {
+		assert(e.id == rare.id && p.x == -1 && t.s == 7 && "Paged view matched wrong entity");
+		++count;
+	});
+	assert(count == 1 && "Paged view miscounted");
+	cout << "Test 17 passed\n";
+}
+
+void test18() {
+	using worms::Position;
+	using worms::Health;
+	static_assert(Component<Position>::Index == 0 && Component<Health>::Index == 1, "Listed indices not constant");
+	constexpr Mask both = MaskBuilder().set<Position>().set<Health>().build();
+	static_assert(both.test(Component<Health>::Bit) && !(both == MaskBuilder().set<Position>().build()), "Mask not folded");
+
+	const index_type unlisted[] = {Component<TestTag>::Index, Component<TestA>::Index, Component<TestS>::Index,
+		Component<TestSoA>::Index, Component<TestFlag>::Index};
+	for (index_type i = 0; i < 5; ++i) {
+		assert(unlisted[i] >= ComponentList<>::Size && unlisted[i] < Params.MaxComponents && "Unlisted index overlaps the list");
+		for (index_type j = 0; j < i; ++j)
+			assert(unlisted[i] != unlisted[j] && "Unlisted indices collide");
+	}
+	assert((maskOf<Position, Health>() == both) && "maskOf differs from MaskBuilder");
+	cout << "Test 18 passed\n";
+}
+
+void test19() {
+	using H = HierarchyStorage<TestNode>;
+	Registry r;
+	const Registry::Scope scope(r);
+	ent_type es[8];
+	World::createEntities(8, es);
+	for (int i = 0; i < 8; ++i)
+		World::addComponent(es[i], TestNode{1 << i, 0});
+	// 0 -> {1 -> {3, 4}, 2}, 5 -> {6}, 7
+	assert(H::attach(es[1], es[0]) && H::attach(es[2], es[0]) && H::attach(es[3], es[1]) && H::attach(es[4], es[1]));
+	assert(H::attach(es[6], es[5]) && "Attach failed");
+	assert(!H::attach(es[0], es[3]) && "Attached a node below itself");
+
+	const int order[] = {0, 1, 3, 4, 2, 5, 6, 7};
+	for (int i = 0; i < 8; ++i)
+		assert(H::entity(i).id == es[order[i]].id && "Nodes not in depth-first order");
+	assert(H::subtreeSize(es[0]) == 5 && H::subtreeSize(es[1]) == 3 && H::parent(es[4]).id == es[1].id);
+
+	auto sweep = [] {
+		for (int i = 0; i < H::size(); ++i)
+			if (H::parent(H::entity(i)).id < 0)
+				H::get(i).world = H::get(i).local;
+		H::propagate([](const TestNode& p, TestNode& c) { c.world = p.world + c.local; });
+	};
+	sweep();
+	assert(Entity{es[4]}.get<TestNode>().world == (1|2|16) && Entity{es[6]}.get<TestNode>().world == (32|64));
+
+	H::detach(es[1]);
+	assert(H::parent(es[1]).id == -1 && H::subtreeSize(es[0]) == 2 && H::entity(H::size()-1).id == es[4].id);
+	assert(H::attach(es[1], es[6]) && H::subtreeSize(es[5]) == 5 && "Reattached subtree miscounted");
+	sweep();
+	assert(Entity{es[3]}.get<TestNode>().world == (32|64|2|8) && "Propagation missed a moved subtree");
+
+	World::delComponent<TestNode>(es[6]);
+	assert(H::parent(es[1]).id == es[5].id && H::subtreeSize(es[5]) == 4 && "Children not handed to parent");
+
+	int count = 0;
+	World::each<TestNode>([&](ent_type, TestNode&) { ++count; });
+	assert(count == 7 && "View over hierarchy miscounted");
+
+	H::destroySubtree(es[5]);
+	assert(H::size() == 3 && World::mask(es[0]).test(Component<TestNode>::Bit) && !World::mask(es[3]).test(Component<TestNode>::Bit));
+	assert(H::subtreeSize(es[0]) == 2 && H::index(es[7]) == 2 && "Subtree removal left gaps");
+	cout << "Test 19 passed\n";
+}
+
+namespace {
+	int added, removed, changed, batches;
+	void countPos(const Observers::Event* evs, size_type n) {
+		++batches;
+		for (index_type i = 0; i < n; ++i) {
+			added += evs[i].kind == Observers::Kind::Added;
+			removed += evs[i].kind == Observers::Kind::Removed;
+			if (evs[i].kind == Observers::Kind::Changed && ++changed == 1)
+				World::patch<TestPos>(evs[i].e, [](TestPos& p) { p.y = 1; });
+		}
+	}
+}
+
+void test20() {
+	Registry r;
+	const Registry::Scope scope(r);
+	World::observe<TestPos>(countPos);
+	ent_type es[100];
+	World::createEntities(100, es);
+	TestPos ps[100] = {};
+	World::addComponents(es, 100, ps);
+	World::addComponent(es[0], TestVel{1, 1});
+	for (int i = 0; i < 100; i += 10)
+		World::patch<TestPos>(es[i], [](TestPos& p) { p.x += 1; });
+	World::delComponent<TestPos>(es[1]);
+	World::destroyEntities(es+2, 3);
+	assert(batches == 0 && Observers::pending(Component<TestPos>::Index) == 114 && "Events not held until delivery");
+	assert(Observers::pending(Component<TestVel>::Index) == 0 && "Recorded an unobserved component");
+
+	World::deliver();
+	assert(batches == 1 && added == 100 && changed == 10 && removed == 4 && "Batch lost events");
+	assert(Observers::pending(Component<TestPos>::Index) == 1 && "Patch from an observer not queued");
+	World::deliver();
+	assert(batches == 2 && changed == 11 && Entity{es[0]}.get<TestPos>().y == 1);
+	World::deliver();
+	assert(batches == 2 && "Delivered an empty batch");
+	cout << "Test 20 passed\n";
+}
+
+void test21() {
+	using P = PackedStorage<TestPos>;
+	Registry r;
+	const Registry::Scope scope(r);
+	ent_type es[50];
+	World::createEntities(50, es);
+	TestPos ps[50] = {};
+	World::addComponents(es, 50, ps);
+	for (int i = 0; i < 50; i += 5)
+		World::addComponent(es[i], TestVel{0, 0});
+
+	const tick_type seen = World::tick();
+	World::advanceTick();
+	World::patch<TestPos>(es[10]).x = 1;
+	Entity{es[11]}.patch<TestPos>([](TestPos& p) { p.x = 1; });
+	World::patch<TestPos>(es[49]).x = 1;
+	World::getComponent<TestPos>(es[12]).x = 1;
+
+	int count = 0;
+	World::eachChanged<TestPos>(seen, [&](ent_type, TestPos& p) { assert(p.x == 1); ++count; });
+	assert(count == 3 && "Unpatched or unstamped entities visited");
+	count = 0;
+	World::eachChanged<TestPos, TestVel>(seen, [&](ent_type e, TestPos&, TestVel&) { assert(e.id == es[10].id); ++count; });
+	assert(count == 1 && "Changed filter ignored the other components");
+	count = 0;
+	World::eachChanged<TestPos>(0, [&](ent_type, TestPos&) { ++count; });
+	assert(count == 50 && "Adds not stamped");
+
+	World::delComponent<TestPos>(es[0]);
+	World::destroyEntities(es+1, 3);
+	P::sort();
+	assert(P::changedAt(es[49]) == World::tick() && P::changedAt(es[10]) == World::tick() && "Tick lost its slot");
+	assert(P::changedAt(es[48]) == seen && "Tick moved to another slot");
+	cout << "Test 21 passed\n";
+}
+
+void test22() {
+	const char* path = "bagel_test.snap";
+	ent_type es[1000];
+	{
+		Registry r;
+		const Registry::Scope scope(r);
+		World::createEntities(1000, es);
+		for (int i = 0; i < 1000; ++i) {
+			World::addComponent(es[i], worms::Position{float(i), 0});
+			if (i % 2)
+				World::addComponent(es[i], worms::Health{i});
+			if (i % 3 == 0)
+				World::addComponent(es[i], worms::Weapon{worms::Weapon::Kind::GRENADE, i});
+			if (i % 5 == 0)
+				World::addComponent(es[i], worms::Physics{float(i), 0, 0, float(-i)});
+		}
+		World::destroyEntities(es+10, 5);
+		World::addComponent(es[0], TestFlag{});
+		assert(!World::saveSnapshot(path) && "Saved an unlisted component");
+		World::delComponent<TestFlag>(es[0]);
+		assert(World::saveSnapshot(path) && "Save failed");
+		assert(!World::loadSnapshot(path) && "Loaded over existing entities");
+	}
+
+	Registry r;
+	const Registry::Scope scope(r);
+	assert(World::loadSnapshot(path) && "Load failed");
+	assert(World::maxId().id == 999 && !World::mask(es[12]).test(Component<worms::Position>::Bit));
+	int count = 0;
+	World::each<worms::Position, worms::Health>([&](ent_type e, worms::Position& p, worms::Health& h) {
+		assert(p.x == e.id && h.value == e.id && e.id % 2 && "Packed component lost");
+		++count;
+	});
+	assert(count == 498 && "Wrong entities restored");
+	count = 0;
+	World::each<worms::Weapon>([&](ent_type e, worms::Weapon& w) { assert(w.ammo == e.id); ++count; });
+	assert(count == 333 && Entity{es[999]}.get<worms::Weapon>().ammo == 999 && "Sparse component lost");
+	count = 0;
+	World::each<worms::Physics>([&](ent_type e, SoARef<worms::Physics> ph) {
+		assert(ph.get<&worms::Physics::accelX>() == e.id && ph.get<&worms::Physics::velY>() == -e.id && "SoA component lost");
+		++count;
+	});
+	assert(count == 199 && "Wrong SoA entities restored");
+	World::delComponent<worms::Position>(es[5]);
+	const ent_type reused = World::createEntity();
+	assert(reused.id >= 10 && reused.id < 15 && "Free list lost");
+
+	std::vector<char> bytes(1 << 20);
+	FILE* f = fopen(path, "rb");
+	bytes.resize(fread(bytes.data(), 1, bytes.size(), f));
+	fclose(f);
+	// a record whose type differs, as after reordering same-sized components
+	std::vector<char> retyped = bytes;
+	reinterpret_cast<Snapshot::Record*>(retyped.data() + sizeof(Snapshot::Header))->type ^= 1;
+	f = fopen(path, "wb");
+	fwrite(retyped.data(), 1, retyped.size(), f);
+	fclose(f);
+	Registry other;
+	{
+		const Registry::Scope inOther(other);
+		assert(!World::loadSnapshot(path) && World::maxId().id == -1 && "Loaded a different component");
+	}
+	f = fopen(path, "wb");
+	fwrite(bytes.data(), 1, bytes.size() / 2, f);
+	fclose(f);
+	Registry fresh;
+	const Registry::Scope inFresh(fresh);
+	assert(!World::loadSnapshot(path) && World::maxId().id == -1 && "Loaded a truncated file");
+	remove(path);
+	cout << "Test 22 passed\n";
+}
+
+void test23() {
+	Registry r;
+	const Registry::Scope scope(r);
+	StateHistory<> history(8);
+	static ent_type es[20000];
+	World::createEntities(20000, es);
+	static worms::Position ps[20000];
+	for (int i = 0; i < 20000; ++i)
+		ps[i] = {float(i), 0};
+	World::addComponents(es, 20000, ps);
+	for (int i = 0; i < 20000; i += 7)
+		World::addComponent(es[i], worms::Weapon{worms::Weapon::Kind::BAZOOKA, 100});
+	for (int i = 0; i < 20000; i += 11)
+		World::addComponent(es[i], worms::Physics{float(i), 0, 0, 0});
+	assert(history.capture() && "Capture failed");
+	const size_type full = history.chunks();
+
+	for (int frame = 1; frame <= 10; ++frame) {
+		World::getComponent<worms::Position>(es[frame]).y = float(frame);
+		World::getComponent<worms::Weapon>(es[7*frame]).ammo -= frame;
+		World::getComponent<worms::Physics>(es[11*frame]).get<&worms::Physics::velY>() = frame;
+		history.capture();
+		assert(history.chunks() <= full + 6*frame && "Unchanged chunks not shared");
+	}
+	assert(history.size() == 8 && "Ring did not drop the oldest frame");
+
+	// frames now hold 3..10; the next capture drops 3 and makes back 3 frame 8
+	World::destroyEntities(es, 100);
+	const ent_type fresh = World::createEntity();
+	World::addComponent(fresh, TestVel{1, 1});
+	World::delComponent<TestVel>(fresh);
+	history.capture();
+	history.restore(3);
+	assert(history.size() == 5 && World::maxId().id == 19999 && "Restore kept newer frames");
+	assert(World::mask(es[5]).test(Component<worms::Position>::Bit) && Entity{es[5]}.get<worms::Position>().y == 5);
+	assert(Entity{es[9]}.get<worms::Position>().y == 0 && Entity{es[56]}.get<worms::Weapon>().ammo == 92 &&
+		Entity{es[63]}.get<worms::Weapon>().ammo == 100);
+	int count = 0;
+	World::each<worms::Weapon>([&](ent_type, worms::Weapon&) { ++count; });
+	assert(count == 2858 && "Restored sparse presence differs");
+	count = 0;
+	World::each<worms::Position>([&](ent_type e, worms::Position& p) { assert(p.x == e.id); ++count; });
+	assert(count == 20000 && "Restored packed storage differs");
+	count = 0;
+	World::each<worms::Physics>([&](ent_type e, SoARef<worms::Physics> ph) {
+		const int frame = e.id % 11 == 0 && e.id <= 88 ? e.id / 11 : 0;
+		assert(ph.get<&worms::Physics::accelX>() == e.id && ph.get<&worms::Physics::velY>() == frame &&
+			"Restored SoA column differs");
+		++count;
+	});
+	assert(count == 1819 && "Restored SoA storage differs");
+
+	// writes made since the last capture are undone as well
+	World::getComponent<worms::Position>(es[5]).y = -1;
+	World::getComponent<worms::Physics>(es[55]).get<&worms::Physics::velY>() = -1;
+	history.restore(0);
+	assert(Entity{es[5]}.get<worms::Position>().y == 5 &&
+		World::getComponent<worms::Physics>(es[55]).get<&worms::Physics::velY>() == 5 &&
+		"Restore kept writes made after the last capture");
+	bool rejected = false;
+	try {
+		StateHistory<> none(0);
+	}
+	catch (const std::invalid_argument&) {
+		rejected = true;
+	}
+	assert(rejected && "Accepted a history without frames");
+	rejected = false;
+	try {
+		history.restore(history.size());
+	}
+	catch (const std::out_of_range&) {
+		rejected = true;
+	}
+	assert(rejected && history.size() == 5 && "Restored a frame it does not hold");
+
+	World::addComponent(es[0], TestFlag{});
+	assert(!history.capture() && "Captured a component it cannot restore");
+	World::delComponent<TestFlag>(es[0]);
+	cout << "Test 23 passed\n";
+}
+
+void system24a(float) { const Profiler::Scope inner("inner24"); }
+void system24b(float) {}
+
+void test24() {
+	const char* path = "bagel_test.trace.json";
+	Profiler::clear();
+	{
+		const Profiler::Scope off("off24");
+	}
+	Scheduler s;
+	s.add(system24a, MaskBuilder().build(), MaskBuilder().set<TestPos>().build(), "system24a");
+	s.add(system24b, MaskBuilder().build(), MaskBuilder().set<TestVel>().build(), "system24b");
+	s.run(0);
+	assert(Profiler::size() == 0 && "Disabled profiler recorded");
+
+	Profiler::enable(true);
+	for (int frame = 0; frame < 3; ++frame)
+		s.run(0);
+	const std::int64_t at = Profiler::now();
+	Profiler::record("outside24", at, 1500);
+	Profiler::enable(false);
+	assert(Profiler::size() == 10 && "Markers lost");
+
+	assert(Profiler::write(path) && "Trace not written");
+	FILE* f = fopen(path, "r");
+	std::string json(1 << 16, '\0');
+	json.resize(fread(&json[0], 1, json.size(), f));
+	fclose(f);
+	remove(path);
+	assert(json.rfind("{\"traceEvents\":[", 0) == 0 && "Not a chrome trace");
+	assert(json.find("\"name\":\"system24a\",\"ph\":\"X\"") != std::string::npos && "System marker missing");
+	assert(json.find("\"name\":\"inner24\"") != std::string::npos && "Nested marker missing");
+	assert(json.find("\"dur\":1.500}") != std::string::npos && "Recorded event missing");
+	assert(json.find("off24") == std::string::npos && "Disabled marker written");
+	Profiler::clear();
+	assert(Profiler::size() == 0 && "Profiler not cleared");
+	cout << "Test 24 passed\n";
+}
+
+void test25() {
+	const char* path = "bagel_test.log";
+	// per tick, the input each id holds; ids 3 and 1000 share a tick, 70000
+	// needs a three byte varint
+	const int ids[] = {0, 3, 1000, 70000};
+	const auto inputOf = [](int tick, int id) {
+		worms::Input in;
+		if (tick % 3 == 0)
+			return in;
+		in.moveDirection = tick % 2 ? -0.3f : 1.0f/3;
+		in.aimAngle = float(id) * 0.0137f + tick;
+		in.jump = tick % 4 == 1;
+		in.fire = id % 2 == 0;
+		return in;
+	};
+	worms::InputLog log(0xdeadbeef);
+	for (int tick = 0; tick < 12; ++tick) {
+		for (int id : ids)
+			log.record(id, inputOf(tick, id));
+		log.endTick();
+	}
+	assert(log.save(path) && "Log not saved");
+	worms::InputLog loaded;
+	assert(worms::InputLog::load(path, loaded) && "Log not loaded");
+	remove(path);
+	assert(loaded.seed() == 0xdeadbeef && loaded.ticks() == 12 && loaded.bytes() == log.bytes() && "Header lost");
+
+	// replaying accumulates the changes back into every id's input, bit-exact
+	const auto same = [](const worms::Input& a, const worms::Input& b) {
+		return memcmp(&a.moveDirection, &b.moveDirection, sizeof(float)) == 0 &&
+			memcmp(&a.aimAngle, &b.aimAngle, sizeof(float)) == 0 && a.jump == b.jump && a.fire == b.fire;
+	};
+	vector<worms::Input> held(70001);
+	worms::InputReplay replay(loaded);
+	int ticks = 0;
+	for (; replay.nextTick(); ++ticks) {
+		// only tick 0 repeats the default every id starts from
+		assert(replay.changes().empty() == (ticks == 0) && "Wrong changes recorded");
+		for (const worms::InputLog::Change& change : replay.changes())
+			held[change.id] = change.input;
+		for (int id : ids)
+			assert(same(held[id], inputOf(ticks, id)) && "Input not replayed");
+	}
+	assert(ticks == 12 && "Wrong tick count");
+	cout << "Test 25 passed\n";
+}
+
+void test26() {
+	const char* path = "bagel_test26.json";
+	Registry r;
+	const Registry::Scope scope(r);
+	Scheduler s;
+	worms::registerSystems(s);
+	const Entity player = worms::createPlayer(10, 20);
+	worms::createProjectile(10, 20, 1, 1, worms::Weapon::Kind::GRENADE);
+
+	// one profiled step, as Match::step runs it
+	Profiler::enable(true);
+	World::patch<worms::Health>(player.entity(), [](worms::Health& h) { h.value -= 10; });
+	s.run(0.01f);
+	World::deliver();
+	Profiler::enable(false);
+	assert(player.get<worms::Position>().x == 10 && "Physics moved a resting worm");
+	assert(Profiler::write(path) && "Trace not written");
+	FILE* f = fopen(path, "r");
+	std::string json(1 << 16, '\0');
+	json.resize(fread(&json[0], 1, json.size(), f));
+	fclose(f);
+	remove(path);
+	for (const char* name : {"Input", "Weapon", "Physics", "Projectile", "Collision", "Health"})
+		assert(json.find("\"name\":\"" + std::string(name) + "\"") != std::string::npos && "System marker missing");
+	Profiler::clear();
+	cout << "Test 26 passed\n";
+}
+
 void run_tests()
 {
 	test1();
+	test2();
+	test3();
+	test4();
+	test5();
+	test6();
+	test7();
+	test8();
+	test9();
+	test10();
+	test11();
+	test12();
+	test13();
+	test14();
+	test15();
+	test16();
+	test17();
+	test18();
+	test19();
+	test20();
+	test21();
+	test22();
+	test23();
+	test24();
+	test25();
+	test26();
+}
+
+int main()
+{
+	run_tests();
 }
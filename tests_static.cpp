@@ -0,0 +1,63 @@
+// bagel under its default Params, as a program without bagel_cfg.h sees
+// it: fixed-size StaticBags and components numbered at runtime
+#define BAGEL_DEFAULT_PARAMS
+#include <iostream>
+#include <cassert>
+#include <string>
+#include "bagel.h"
+using namespace std;
+using namespace bagel;
+
+static_assert(!Params.DynamicResize, "Default Params must use StaticBag");
+
+struct StaticPos { float x, y; };
+struct StaticName { std::string s; };
+struct StaticNode { int local, world; };
+namespace bagel {
+	template <> struct Storage<StaticPos> { using type = PackedStorage<StaticPos>; };
+	template <> struct Storage<StaticName> { using type = PackedStorage<StaticName>; };
+	template <> struct Storage<StaticNode> { using type = HierarchyStorage<StaticNode>; };
+}
+
+void test1() {
+	Registry r;
+	const Registry::Scope scope(r);
+	ent_type es[5];
+	World::createEntities(5, es);
+	for (int i = 0; i < 5; ++i) {
+		World::addComponent(es[i], StaticPos{float(i), 0});
+		World::addComponent(es[i], StaticName{std::string(40, char('a' + i))});
+	}
+	World::delComponent<StaticName>(es[1]);
+	const ent_type doomed[] = {es[0], es[3]};
+	World::destroyEntities(doomed, 2);
+
+	int count = 0;
+	World::each<StaticPos, StaticName>([&](ent_type e, StaticPos& p, StaticName& n) {
+		assert(p.x == e.id && n.s == std::string(40, char('a' + e.id)) && "Component moved badly");
+		++count;
+	});
+	assert(count == 2 && PackedStorage<StaticName>::size() == 2 && "Wrong components removed");
+	cout << "Test 1 passed\n";
+}
+
+void test2() {
+	using H = HierarchyStorage<StaticNode>;
+	Registry r;
+	const Registry::Scope scope(r);
+	ent_type es[4];
+	World::createEntities(4, es);
+	for (int i = 0; i < 4; ++i)
+		World::addComponent(es[i], StaticNode{1 << i, 0});
+	// 0 -> {1 -> {2}}, 3
+	assert(H::attach(es[1], es[0]) && H::attach(es[2], es[1]) && "Attach failed");
+	H::destroySubtree(es[1]);
+	assert(H::size() == 2 && H::subtreeSize(es[0]) == 1 && H::index(es[3]) == 1 && "Subtree removal left gaps");
+	cout << "Test 2 passed\n";
+}
+
+int main()
+{
+	test1();
+	test2();
+}
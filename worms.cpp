@@ -1,4 +1,6 @@
 #include "worms.h"
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 constexpr float BAZOOKA_PROJECTILE_WEIGHT = 0.5f;
 constexpr float GRENADE_PROJECTILE_WEIGHT = 0.7f;
@@ -9,85 +11,249 @@ namespace worms {
 
 //systems
 
-bagel::Mask CollisionSystem::getMask() {
-    bagel::MaskBuilder builder;
-    return builder.set<Position>().build();
-}
-
 void CollisionSystem::update(float deltaTime) {
-    bagel::Mask mask = getMask();
+    bagel::World::each<Position>([](bagel::ent_type, Position&) { });
+}
 
-    for (bagel::ent_type entity = {0}; entity.id <= bagel::World::maxId().id; ++entity.id) {
-        if (bagel::World::mask(entity).test(mask)) { }
+void PhysicsSystem::update(float deltaTime) {
+    //spawns and despawns shuffle the slots, win back id order a little every frame
+    //the group is owned once registerSystems ran, callers that skipped it have nothing to sort
+    if (bagel::Group<Position, Physics>::owned())
+        bagel::Group<Position, Physics>::sort(bagel::IdOrder{}, std::chrono::microseconds(50));
+
+    using Columns = bagel::SoAStorage<Physics>;
+    const float* accelX = Columns::field<&Physics::accelX>();
+    const float* accelY = Columns::field<&Physics::accelY>();
+    float* velX = Columns::field<&Physics::velX>();
+    float* velY = Columns::field<&Physics::velY>();
+
+    //integrate velocity of every physics entity at once, compiler can vectorize this loop
+    for (bagel::index_type i = 0; i < Columns::size(); ++i) {
+        velX[i] += accelX[i] * deltaTime;
+        velY[i] += accelY[i] * deltaTime;
     }
-}
 
+    //positions are split into chunks across the worker threads
+    auto& positions = bagel::PackedStorage<Position>::data();
+    const bagel::tick_type now = bagel::World::tick();
+    bagel::World::parallelEach<Position, Physics>([=, &positions](bagel::ent_type, Position& position, bagel::SoARef<Physics> physics) {
+        const float velX = physics.get<&Physics::velX>();
+        const float velY = physics.get<&Physics::velY>();
+        //resting entities keep their change tick, so readers of changed positions skip them
+        if (velX == 0.0f && velY == 0.0f)
+            return;
+        bagel::PackedStorage<Position>::stamp(positions, position, now);
+        position.x += velX * deltaTime;
+        position.y += velY * deltaTime;
+    });
+}
 
-bagel::Mask PhysicsSystem::getMask() {
-    bagel::MaskBuilder builder;
-    return builder.set<Position>().set<Physics>().build();
+void WeaponSystem::update(float deltaTime) {
+    bagel::World::each<Weapon, Input>([](bagel::ent_type, Weapon&, Input&) { });
 }
 
+void ProjectileSystem::update(float deltaTime) {
+    bagel::World::each<ProjectileData, Position>([](bagel::ent_type, ProjectileData&, Position&) { });
+}
 
-void PhysicsSystem::update(float deltaTime) {
-    bagel::Mask mask = getMask();
+void InputSystem::update(float deltaTime) {
+    bagel::World::each<Input, Physics>([](bagel::ent_type, Input&, bagel::SoARef<Physics>) { }); //possible to change in future to not require physics
+}
 
-    for (bagel::ent_type entity = {0}; entity.id <= bagel::World::maxId().id; ++entity.id) {
-        if (bagel::World::mask(entity).test(mask)) { }
+void HealthSystem::react(const bagel::Observers::Event* events, bagel::size_type count) {
+    const bagel::Profiler::Scope profile("Health");
+    for (bagel::index_type i = 0; i < count; ++i) {
+        const bagel::Entity entity{events[i].e};
+        //a worm may be patched several times or already be gone by now
+        if (events[i].kind != bagel::Observers::Kind::Changed || !entity.has<Health>())
+            continue;
+        if (entity.get<Health>().value <= 0)
+            entity.destroy();
     }
 }
 
-
-bagel::Mask WeaponSystem::getMask() {
-    bagel::MaskBuilder builder;
-    return builder.set<Weapon>().set<Input>().build();
+void registerSystems(bagel::Scheduler& scheduler) {
+    using bagel::MaskBuilder;
+    bagel::World::group<Position, Physics>();
+    bagel::World::observe<Health>(HealthSystem::react);
+    scheduler.add(InputSystem::update,
+        MaskBuilder().set<Input>().build(),
+        MaskBuilder().set<Physics>().build(), "Input");
+    scheduler.add(WeaponSystem::update,
+        MaskBuilder().set<Input>().build(),
+        MaskBuilder().set<Weapon>().build(), "Weapon");
+    scheduler.add(PhysicsSystem::update,
+        MaskBuilder().build(),
+        MaskBuilder().set<Position>().set<Physics>().build(), "Physics");
+    scheduler.add(ProjectileSystem::update,
+        MaskBuilder().set<Position>().build(),
+        MaskBuilder().set<ProjectileData>().build(), "Projectile");
+    scheduler.add(CollisionSystem::update,
+        MaskBuilder().build(),
+        MaskBuilder().set<Position>().set<Health>().build(), "Collision");
 }
 
-void WeaponSystem::update(float deltaTime) {
-    bagel::Mask mask = getMask();
+//replay
 
-    for (bagel::ent_type entity = {0}; entity.id <= bagel::World::maxId().id; ++entity.id) {
-        if (bagel::World::mask(entity).test(mask)) { }
+namespace {
+constexpr std::uint8_t LOG_MAGIC[4] = {'W', 'R', 'P', 'L'};
+//flags of a change, values that are zero are left out of the stream
+constexpr std::uint8_t JUMP = 1, FIRE = 2, MOVE = 4, AIM = 8;
+
+void putVarint(std::vector<std::uint8_t>& out, std::uint32_t v) {
+    for (; v >= 0x80; v >>= 7)
+        out.push_back(static_cast<std::uint8_t>(v | 0x80));
+    out.push_back(static_cast<std::uint8_t>(v));
+}
+
+bool getVarint(const std::vector<std::uint8_t>& in, std::size_t& at, std::uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && at < in.size(); shift += 7) {
+        const std::uint8_t b = in[at++];
+        v |= static_cast<std::uint32_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
     }
+    return false;
 }
 
-bagel::Mask ProjectileSystem::getMask() {
-    bagel::MaskBuilder builder;
-    return builder.set<ProjectileData>().set<Position>().build();
+std::uint32_t byteSwap(std::uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
 }
 
-void ProjectileSystem::update(float deltaTime) {
-    bagel::Mask mask = getMask();
+//byte-swapped, so the zero low mantissa bits of values like 1.0 or -0.5 need no bytes
+std::uint32_t floatBits(float f) {
+    std::uint32_t v;
+    std::memcpy(&v, &f, sizeof(v));
+    return byteSwap(v);
+}
 
-    for (bagel::ent_type entity = {0}; entity.id <= bagel::World::maxId().id; ++entity.id) {
-        if (bagel::World::mask(entity).test(mask)) { }
-    }
+float bitsFloat(std::uint32_t v) {
+    v = byteSwap(v);
+    float f;
+    std::memcpy(&f, &v, sizeof(f));
+    return f;
 }
 
-bagel::Mask InputSystem::getMask() {
-    bagel::MaskBuilder builder;
-    return builder.set<Input>().set<Physics>().build(); //possible to change in future to not require physics
+bool sameInput(const Input& a, const Input& b) {
+    return floatBits(a.moveDirection) == floatBits(b.moveDirection) && a.jump == b.jump &&
+        a.fire == b.fire && floatBits(a.aimAngle) == floatBits(b.aimAngle);
+}
 }
 
-void InputSystem::update(float deltaTime) {
-    bagel::Mask mask = getMask();
+InputLog::InputLog(std::uint32_t seed) : _seed(seed) {
+    putVarint(_bytes, seed);
+}
+
+void InputLog::record(int id, const Input& input) {
+    if (id >= static_cast<int>(_last.size()))
+        _last.resize(id + 1);
+    if (sameInput(_last[id], input))
+        return;
+    _last[id] = input;
+    _pending.push_back({id, input});
+}
+
+void InputLog::recordWorld() {
+    bagel::World::each<Input>([this](bagel::ent_type e, Input& input) { record(e.id, input); });
+}
 
-    for (bagel::ent_type entity = {0}; entity.id <= bagel::World::maxId().id; ++entity.id) {
-        if (bagel::World::mask(entity).test(mask)) { }
+void InputLog::endTick() {
+    putVarint(_bytes, static_cast<std::uint32_t>(_pending.size()));
+    for (const Change& change : _pending) {
+        const Input& input = change.input;
+        putVarint(_bytes, static_cast<std::uint32_t>(change.id));
+        _bytes.push_back((input.jump ? JUMP : 0) | (input.fire ? FIRE : 0) |
+            (floatBits(input.moveDirection) ? MOVE : 0) | (floatBits(input.aimAngle) ? AIM : 0));
+        if (floatBits(input.moveDirection))
+            putVarint(_bytes, floatBits(input.moveDirection));
+        if (floatBits(input.aimAngle))
+            putVarint(_bytes, floatBits(input.aimAngle));
     }
+    _pending.clear();
+    ++_ticks;
 }
 
-bagel::Mask HealthSystem::getMask() {
-    bagel::MaskBuilder builder;
-    return builder.set<Health>().build();
+bool InputLog::save(const char* path) const {
+    FILE* file = std::fopen(path, "wb");
+    if (!file)
+        return false;
+    std::vector<std::uint8_t> header(LOG_MAGIC, LOG_MAGIC + 4);
+    putVarint(header, static_cast<std::uint32_t>(_ticks));
+    const bool written = std::fwrite(header.data(), 1, header.size(), file) == header.size() &&
+        std::fwrite(_bytes.data(), 1, _bytes.size(), file) == _bytes.size();
+    return std::fclose(file) == 0 && written;
 }
 
-void HealthSystem::update(float deltaTime) {
-    bagel::Mask mask = getMask();
+bool InputLog::load(const char* path, InputLog& log) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file)
+        return false;
+    std::vector<std::uint8_t> bytes;
+    std::uint8_t chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0;)
+        bytes.insert(bytes.end(), chunk, chunk + n);
+    std::fclose(file);
+
+    std::size_t at = 4;
+    std::uint32_t ticks, seed;
+    if (bytes.size() < 4 || std::memcmp(bytes.data(), LOG_MAGIC, 4) != 0 || !getVarint(bytes, at, ticks))
+        return false;
+    bytes.erase(bytes.begin(), bytes.begin() + at);
+    at = 0;
+    if (!getVarint(bytes, at, seed))
+        return false;
+    log = InputLog(seed);
+    log._bytes = std::move(bytes);
+    log._ticks = static_cast<int>(ticks);
+    return true;
+}
+
+InputReplay::InputReplay(const InputLog& log) : _log(log), _at(0) {
+    std::uint32_t seed;
+    getVarint(_log.bytes(), _at, seed);
+}
+
+bool InputReplay::nextTick() {
+    const std::vector<std::uint8_t>& in = _log.bytes();
+    _changes.clear();
+    std::uint32_t count;
+    if (!getVarint(in, _at, count))
+        return false;
+    for (std::uint32_t i = 0; i < count; ++i) {
+        InputLog::Change change{};
+        std::uint32_t id, bits;
+        if (!getVarint(in, _at, id) || _at >= in.size())
+            return false;
+        const std::uint8_t flags = in[_at++];
+        change.id = static_cast<int>(id);
+        change.input.jump = flags & JUMP;
+        change.input.fire = flags & FIRE;
+        if (flags & MOVE) {
+            if (!getVarint(in, _at, bits))
+                return false;
+            change.input.moveDirection = bitsFloat(bits);
+        }
+        if (flags & AIM) {
+            if (!getVarint(in, _at, bits))
+                return false;
+            change.input.aimAngle = bitsFloat(bits);
+        }
+        _changes.push_back(change);
+    }
+    return true;
+}
 
-    for (bagel::ent_type entity = {0}; entity.id <= bagel::World::maxId().id; ++entity.id) {
-        if (bagel::World::mask(entity).test(mask)) { }
+bool InputReplay::applyToWorld() {
+    if (!nextTick())
+        return false;
+    //ids the world never created, or that hold no Input, are skipped
+    for (const InputLog::Change& change : _changes) {
+        const bagel::Entity entity{bagel::ent_type{change.id}};
+        if (change.id <= bagel::World::maxId().id && entity.has<Input>())
+            entity.get<Input>() = change.input;
     }
+    return true;
 }
 
 //entities
@@ -139,6 +305,11 @@ bagel::Entity createTerrain(float x, float y) {
     return entity;
 }
 
+void createTerrain(const Position* positions, int count, bagel::ent_type* out) {
+    bagel::World::createEntities(count, out);
+    bagel::World::addComponents(out, count, positions);
+}
+
 bagel::Entity createCollectable(float x, float y, Collectable::Type type, int value) {
     bagel::Entity entity = bagel::Entity::create();
     Position position{x, y};
@@ -4,6 +4,7 @@
  */
  #pragma once
 
+ #include <cstdint>
  #include <vector>
  #include <string>
  #include "bagel.h"
@@ -108,6 +109,23 @@
      int value = DEFAULT_PACK_VALUE;
  };
 
+ }
+
+ namespace bagel {
+     template <> struct Storage<worms::Position> { using type = PackedStorage<worms::Position>; };
+     template <> struct Storage<worms::Health> { using type = PackedStorage<worms::Health>; };
+     template <> struct Storage<worms::Physics> { using type = SoAStorage<worms::Physics>; };
+     BAGEL_COMPONENT_LIST
+     template <> struct SoAFields<worms::Physics> {
+         static constexpr auto list = std::make_tuple(
+             &worms::Physics::accelX, &worms::Physics::accelY,
+             &worms::Physics::velX, &worms::Physics::velY,
+             &worms::Physics::weight, &worms::Physics::isAffectedByGravity);
+     };
+ }
+
+ namespace worms {
+
  //systems
 
  /**
@@ -117,21 +135,16 @@
  class CollisionSystem {
  public:
      static void update(float deltaTime);
-
- private:
-     static bagel::Mask getMask();
  };
 
  /**
   * @brief system for handling physics
   * update positions of entities based on their physics properties
+  * physics is stored as structure of arrays, velocities are integrated in bulk
   */
  class PhysicsSystem {
  public:
      static void update(float deltaTime);
-
- private:
-     static bagel::Mask getMask();
  };
 
  /**
@@ -141,9 +154,6 @@
  class WeaponSystem {
  public:
      static void update(float deltaTime);
-
- private:
-     static bagel::Mask getMask();
  };
 
  /**
@@ -153,9 +163,6 @@
  class ProjectileSystem {
  public:
      static void update(float deltaTime);
-
- private:
-     static bagel::Mask getMask();
  };
 
  /**
@@ -165,22 +172,129 @@
  class InputSystem {
  public:
      static void update(float deltaTime);
-
- private:
-     static bagel::Mask getMask();
  };
 
  /**
   * @brief system for managing health
   * based on health handling scenrios in the game like if health < 0 delete entity
   * another example health < 40 turn worm to red, or after health pack turn worm to green for a while
+  * observes Health instead of polling, so it only visits worms whose health changed
   */
  class HealthSystem {
  public:
-     static void update(float deltaTime);
+     /**
+      * @brief handles the Health events gathered since the last delivery
+      * @param events added, removed and patched Health components
+      * @param count number of events
+      */
+     static void react(const bagel::Observers::Event* events, bagel::size_type count);
+ };
+
+ /**
+  * @brief registers all worms systems with the components each one reads and writes
+  * systems that touch different components run in parallel
+  * each system shows up under its own name in bagel::Profiler traces
+  * reactive systems run on bagel::World::deliver(), call it after each scheduler run
+  * @param scheduler scheduler to register to
+  */
+ void registerSystems(bagel::Scheduler& scheduler);
+
+ //replay
+
+ /**
+  * @brief compact recording of Input components for deterministic replay
+  * the log starts with the RNG seed, then holds one record per tick listing only the inputs
+  * that changed that tick, all numbers as LEB128 varints, so an idle tick costs a single byte
+  */
+ class InputLog {
+ public:
+     /**
+      * @brief one changed input of a tick
+      */
+     struct Change {
+         int id;
+         Input input;
+     };
+
+     /**
+      * @brief starts an empty log
+      * @param seed RNG seed the recorded match was played with
+      */
+     explicit InputLog(std::uint32_t seed = 0);
+
+     std::uint32_t seed() const { return _seed; }
+     int ticks() const { return _ticks; }
+     const std::vector<std::uint8_t>& bytes() const { return _bytes; }
+
+     /**
+      * @brief records the input of an id for the current tick, if it differs from its last one
+      * @param id entity id or any other small non-negative number
+      * @param input input state during this tick
+      */
+     void record(int id, const Input& input);
+
+     /**
+      * @brief records the Input component of every entity holding one
+      */
+     void recordWorld();
+
+     /**
+      * @brief closes the current tick, record() then fills the next one
+      */
+     void endTick();
+
+     /**
+      * @brief writes the log to a file
+      * @return false if the file could not be written
+      */
+     bool save(const char* path) const;
+
+     /**
+      * @brief reads a log written by save
+      * @return false if the file is missing or not an input log
+      */
+     static bool load(const char* path, InputLog& log);
+
+ private:
+     std::uint32_t _seed;
+     int _ticks = 0;
+     std::vector<std::uint8_t> _bytes;
+     std::vector<Change> _pending; //changes of the current tick
+     std::vector<Input> _last; //last recorded input of each id
+ };
+
+ /**
+  * @brief plays an InputLog back one tick at a time, as fast as the caller steps
+  */
+ class InputReplay {
+ public:
+     /**
+      * @brief starts at the first tick of log, which must outlive the replay
+      */
+     explicit InputReplay(const InputLog& log);
+
+     /**
+      * @brief decodes the next tick into changes()
+      * @return false after the last tick or on a corrupt log
+      */
+     bool nextTick();
+
+     /**
+      * @brief inputs that changed in the tick read by the last nextTick
+      */
+     const std::vector<InputLog::Change>& changes() const { return _changes; }
+
+     /**
+      * @brief nextTick, then writes its changes into the Input components of the world,
+      * skipping ids that hold no Input
+      * @return false after the last tick
+      */
+     bool applyToWorld();
 
  private:
-     static bagel::Mask getMask();
+     const InputLog& _log;
+     std::size_t _at;
+     std::vector<InputLog::Change> _changes;
  };
 
  //entities
@@ -211,6 +325,14 @@
   */
  bagel::Entity createTerrain(float x, float y);
 
+ /**
+  * @brief creates many terrain surface entities at once
+  * @param positions position of each terrain tile
+  * @param count number of tiles
+  * @param out receives the created entities, must hold count entities
+  */
+ void createTerrain(const Position* positions, int count, bagel::ent_type* out);
+
  /**
   * @brief creates a collectable item entity
   *